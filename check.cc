@@ -5,6 +5,23 @@
 #include <iostream>
 #include <stdexcept>
 #include <filesystem>
+#include <thread>
+
+
+// A length-prefixed record, serialized in place by dbi::put_encoded()
+struct tagged {
+    uint8_t tag;
+    std::string name;
+};
+
+template<>
+struct lmdb::encoder<tagged> {
+    static size_t size(const tagged &t) { return 1 + t.name.size(); }
+    static void encode(const tagged &t, char *data) {
+        data[0] = char(t.tag);
+        std::memcpy(data + 1, t.name.data(), t.name.size());
+    }
+};
 
 
 int main() {
@@ -356,6 +373,1134 @@ int main() {
 
 
 
+    // Commit notification
+
+    {
+        auto notifier = lmdb::notifier::open(env);
+        std::size_t before = notifier.latest();
+
+        if (notifier.wait(before, std::chrono::milliseconds(10)) > before) throw std::runtime_error("notifier woke without a commit");
+
+        std::size_t seen = 0;
+        std::thread waiter([&]{ seen = notifier.wait(before, std::chrono::seconds(10)); });
+
+        {
+            auto txn = lmdb::txn::begin(env);
+            mydb.put(txn, "notified", "yes");
+            notifier.commit(txn);
+        }
+
+        waiter.join();
+        if (seen <= before) throw std::runtime_error("notifier didn't see commit");
+        if (notifier.latest() != seen) throw std::runtime_error("notifier latest mismatch");
+    }
+
+
+
+    // Map warm-up and access hints
+
+    {
+        env.prefetch();
+        env.prefetch(2);
+
+        auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        env.prefetch(txn, mydb);
+        env.prefetch(txn, mydb, "a", "m", 2);
+
+        lmdb::access_hint hint(env, MADV_SEQUENTIAL);
+
+        auto cursor = lmdb::cursor::open(txn, mydb);
+        std::string_view key, val;
+        size_t n = 0;
+        for (bool ok = cursor.get(key, val, MDB_FIRST); ok; ok = cursor.get(key, val, MDB_NEXT)) n++;
+        if (n != mydb.size(txn)) throw std::runtime_error("bad scan under access hint");
+    }
+
+    // Reader table monitoring
+
+    {
+        auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+
+        for (int i = 0; i < 3; i++) {
+            auto txn = lmdb::txn::begin(env);
+            mydb.put(txn, "lagkey", std::to_string(i));
+            txn.commit();
+        }
+
+        auto readers = env.readers();
+        readers.erase(std::remove_if(readers.begin(), readers.end(), [](const auto &r) { return r.txnid == lmdb::reader_info::idle; }), readers.end());
+        if (readers.size() != 1) throw std::runtime_error("bad reader list");
+
+        auto report = lmdb::reader_monitor::check(env);
+        if (report.lag() != 3) throw std::runtime_error("bad reader lag");
+
+        std::atomic<int> fired = 0;
+        {
+            lmdb::reader_monitor monitor(env, 3, [&](const lmdb::reader_report &r) {
+                if (r.lag() >= 3) fired++;
+            }, std::chrono::milliseconds(1));
+            while (monitor.passes() < 2) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            if (monitor.last().oldest_txnid != readers[0].txnid) throw std::runtime_error("bad monitor report");
+        }
+        if (fired < 2) throw std::runtime_error("lag callback not fired");
+
+        {
+            // A throwing callback doesn't lose the pass's report
+            lmdb::reader_monitor monitor(env, 3, [](const lmdb::reader_report &) {
+                throw std::runtime_error("callback failed");
+            }, std::chrono::milliseconds(1));
+            while (monitor.passes() < 2) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            if (monitor.last().lag() != 3) throw std::runtime_error("report lost to a throwing callback");
+        }
+
+        rtxn.abort();
+        if (lmdb::reader_monitor::check(env).lag() != 0) throw std::runtime_error("lag after abort");
+    }
+
+    // Freelist analysis
+
+    {
+        auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+
+        {
+            auto txn = lmdb::txn::begin(env);
+            mydb.put(txn, "lagkey", "freed");
+            txn.commit();
+        }
+
+        auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        auto stat = env.freelist(txn);
+        if (stat.free_pages == 0 || stat.entries == 0) throw std::runtime_error("empty freelist");
+        if (stat.reusable_pages + stat.pinned_pages != stat.free_pages) throw std::runtime_error("bad freelist split");
+        if (stat.pinned_pages == 0) throw std::runtime_error("reader didn't pin freelist");
+        if (stat.largest_run == 0 || stat.largest_run > stat.free_pages || stat.runs == 0) throw std::runtime_error("bad freelist runs");
+        if (stat.live_pages() > stat.used_pages) throw std::runtime_error("bad live pages");
+    }
+
+    // Per-database space accounting
+
+    {
+        auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        auto report = env.space(txn);
+
+        auto it = std::find_if(report.begin(), report.end(), [](const auto &s) { return s.name == "mydb"; });
+        if (it == report.end()) throw std::runtime_error("space report missing mydb");
+        if (it->stat.ms_entries != mydb.size(txn) || it->sampled != it->stat.ms_entries) throw std::runtime_error("bad space entries");
+        if (it->avg_key_size <= 0 || it->avg_value_size <= 0) throw std::runtime_error("bad space sizes");
+        if (std::find_if(report.begin(), report.end(), [](const auto &s) { return s.name.empty(); }) == report.end()) throw std::runtime_error("space report missing main db");
+
+        for (size_t i = 1; i < report.size(); i++) {
+            if (report[i - 1].bytes() < report[i].bytes()) throw std::runtime_error("space report not sorted");
+        }
+    }
+
+    // Templated comparators
+
+    {
+        auto txn = lmdb::txn::begin(env);
+
+        auto revdb = lmdb::dbi::open(txn, "cmp_reverse", MDB_CREATE);
+        revdb.set_compare<lmdb::cmp::reverse<>>(txn);
+        for (auto k : { "b", "a", "c", "ab" }) revdb.put(txn, k, "");
+
+        auto intdb = lmdb::dbi::open(txn, "cmp_int", MDB_CREATE | MDB_DUPSORT);
+        intdb.set_compare<lmdb::cmp::big_endian<int32_t>>(txn);
+        intdb.set_dupsort<lmdb::cmp::little_endian<uint64_t>>(txn);
+        for (int32_t k : { 5, -3, 70000, 0 }) {
+            char buf[4] = { char(uint32_t(k) >> 24), char(uint32_t(k) >> 16), char(uint32_t(k) >> 8), char(k) };
+            intdb.put(txn, std::string_view(buf, 4), lmdb::to_sv<uint64_t>(0x100));
+            intdb.put(txn, std::string_view(buf, 4), lmdb::to_sv<uint64_t>(0x2));
+        }
+
+        using tuple_cmp = lmdb::cmp::tuple<lmdb::cmp::length_prefixed<>, lmdb::cmp::big_endian<uint16_t>>;
+        auto tupdb = lmdb::dbi::open(txn, "cmp_tuple", MDB_CREATE);
+        tupdb.set_compare<tuple_cmp>(txn);
+        tupdb.put(txn, std::string("\x01" "b" "\x00\x01", 4), "b1");
+        tupdb.put(txn, std::string("\x02" "ab" "\x00\x02", 5), "ab2");
+        tupdb.put(txn, std::string("\x02" "ab" "\x01\x00", 5), "ab256");
+
+        auto collect = [&](lmdb::dbi &d, bool vals) {
+            std::string out;
+            auto cursor = lmdb::cursor::open(txn, d);
+            std::string_view key, val;
+            for (bool ok = cursor.get(key, val, MDB_FIRST); ok; ok = cursor.get(key, val, MDB_NEXT)) {
+                out += vals ? std::string(val) : std::string(key);
+                out += ",";
+            }
+            return out;
+        };
+
+        if (collect(revdb, false) != "c,b,ab,a,") throw std::runtime_error("bad reverse order");
+        if (collect(tupdb, true) != "ab2,ab256,b1,") throw std::runtime_error("bad tuple order");
+
+        std::vector<int32_t> keys;
+        std::vector<uint64_t> dups;
+        auto cursor = lmdb::cursor::open(txn, intdb);
+        std::string_view key, val;
+        for (bool ok = cursor.get(key, val, MDB_FIRST); ok; ok = cursor.get(key, val, MDB_NEXT)) {
+            auto *p = reinterpret_cast<const unsigned char *>(key.data());
+            keys.push_back(int32_t(uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3]));
+            dups.push_back(lmdb::from_sv<uint64_t>(val));
+        }
+        if (keys != std::vector<int32_t>{ -3, -3, 0, 0, 5, 5, 70000, 70000 }) throw std::runtime_error("bad big_endian order");
+        if (dups[0] != 0x2 || dups[1] != 0x100) throw std::runtime_error("bad little_endian dup order");
+
+        if (lmdb::cmp::lexical::compare("abcdefghij", 10, "abcdefghik", 10) >= 0) throw std::runtime_error("bad lexical compare");
+        if (lmdb::cmp::lexical::compare("abcdefgh", 8, "abcdefghi", 9) >= 0) throw std::runtime_error("bad lexical length tie");
+
+        txn.abort();
+    }
+
+    // Sharded environments
+
+    for (bool byRange : { false, true }) {
+        std::filesystem::remove_all("testdb_sharded/");
+
+        std::vector<std::string> bounds;
+        if (byRange) bounds = { "key030", "key060" };
+        auto senv = lmdb::sharded_env::open("testdb_sharded", 3, [](lmdb::env &e) { e.set_max_dbs(4); }, bounds);
+
+        lmdb::sharded_dbi sdbi;
+        {
+            auto txn = lmdb::sharded_txn::begin(senv);
+            sdbi = lmdb::sharded_dbi::open(txn, "sharded", MDB_CREATE);
+            txn.commit();
+        }
+
+        lmdb::sharded_batch batch(senv);
+        for (int i = 0; i < 100; i++) {
+            char key[16];
+            std::snprintf(key, sizeof(key), "key%03d", i);
+            batch.put(key, std::to_string(i));
+        }
+        batch.del("key050");
+        sdbi.write(senv, batch);
+
+        {
+            auto txn = lmdb::sharded_txn::begin(senv);
+            sdbi.put(txn, "key100", "100");
+            txn.commit();
+        }
+
+        {
+            // Write locks are only taken in shard order
+            auto txn = lmdb::sharded_txn::begin(senv, 0, { 1 });
+            txn.shard(2);
+            bool thrown = false;
+            try {
+                txn.shard(0);
+            } catch (const lmdb::error& e) {
+                thrown = e.code() == MDB_BAD_TXN;
+            }
+            if (!thrown) throw std::runtime_error("sharded_txn locked a shard out of order");
+            txn.abort();
+        }
+
+        auto txn = lmdb::sharded_txn::begin(senv, MDB_RDONLY);
+        if (sdbi.size(txn) != 100) throw std::runtime_error("bad sharded size");
+
+        std::string_view v;
+        if (!sdbi.get(txn, "key042", v) || v != "42") throw std::runtime_error("bad sharded get");
+        if (sdbi.get(txn, "key050", v)) throw std::runtime_error("sharded del failed");
+
+        if (byRange) {
+            if (senv.route("key010") != 0 || senv.route("key030") != 1 || senv.route("key099") != 2) throw std::runtime_error("bad range routing");
+        }
+
+        {
+            auto cursor = lmdb::sharded_cursor::open(txn, sdbi);
+            std::string_view key, val;
+            std::string prev;
+            size_t n = 0;
+            for (bool ok = cursor.get(key, val, MDB_FIRST); ok; ok = cursor.get(key, val, MDB_NEXT)) {
+                if (std::string(key) <= prev) throw std::runtime_error("sharded cursor out of order");
+                prev = key;
+                n++;
+            }
+            if (n != 100) throw std::runtime_error("bad sharded cursor count");
+
+            key = "key0495";
+            if (!cursor.get(key, val, MDB_SET_RANGE) || key != "key051") throw std::runtime_error("bad sharded SET_RANGE");
+        }
+
+        txn.abort();
+    }
+    std::filesystem::remove_all("testdb_sharded/");
+
+    // Write buffer
+
+    {
+        lmdb::dbi wdb;
+        {
+            auto txn = lmdb::txn::begin(env);
+            wdb = lmdb::dbi::open(txn, "wbuf", MDB_CREATE);
+            wdb.put(txn, "a", "db-a");
+            wdb.put(txn, "c", "db-c");
+            wdb.put(txn, "e", "db-e");
+            txn.commit();
+        }
+
+        std::filesystem::remove("testdb/wbuf.journal");
+
+        {
+            lmdb::write_buffer buf(env, wdb, 0, "testdb/wbuf.journal");
+            buf.put("b", "buf-b");
+            buf.put("c", "buf-c");
+            buf.del("e");
+            buf.put("f", "buf-f");
+        }
+
+        lmdb::write_buffer buf(env, wdb, 0, "testdb/wbuf.journal");
+        if (buf.size() != 4) throw std::runtime_error("journal not replayed");
+
+        {
+            auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+            std::string v;
+            if (!buf.get(txn, "a", v) || v != "db-a") throw std::runtime_error("bad buffered get 1");
+            if (!buf.get(txn, "c", v) || v != "buf-c") throw std::runtime_error("bad buffered get 2");
+            if (buf.get(txn, "e", v)) throw std::runtime_error("bad buffered get 3");
+
+            auto cursor = buf.open_cursor(txn);
+            std::string_view key, val;
+            std::string out;
+            for (bool ok = cursor.get(key, val, MDB_FIRST); ok; ok = cursor.get(key, val, MDB_NEXT)) {
+                out += std::string(key) + "=" + std::string(val) + ",";
+            }
+            if (out != "a=db-a,b=buf-b,c=buf-c,f=buf-f,") throw std::runtime_error("bad buffered cursor");
+
+            key = "d";
+            if (!cursor.get(key, val, MDB_SET_RANGE) || key != "f") throw std::runtime_error("bad buffered SET_RANGE");
+        }
+
+        buf.flush();
+        if (buf.size() != 0 || buf.bytes() != 0) throw std::runtime_error("buffer not empty after flush");
+
+        {
+            auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+            std::string_view v;
+            if (!wdb.get(txn, "c", v) || v != "buf-c") throw std::runtime_error("flush didn't write");
+            if (wdb.get(txn, "e", v)) throw std::runtime_error("flush didn't delete");
+            if (wdb.size(txn) != 4) throw std::runtime_error("bad size after flush");
+        }
+
+        if (lmdb::write_buffer(env, wdb, 0, "testdb/wbuf.journal").size() != 0) throw std::runtime_error("journal not cleared");
+
+        // Writes made while a flush rewrites the journal are kept in it
+        {
+            size_t pending;
+            {
+                lmdb::write_buffer concurrent(env, wdb, 0, "testdb/wbuf.journal");
+                std::thread writer([&] {
+                    for (int i = 0; i < 2000; i++) concurrent.put("j" + std::to_string(i), "v");
+                });
+                for (int i = 0; i < 20; i++) concurrent.flush();
+                writer.join();
+                pending = concurrent.size();
+            }
+            lmdb::write_buffer replayed(env, wdb, 0, "testdb/wbuf.journal");
+            if (replayed.size() != pending) throw std::runtime_error("journal lost writes made during a flush");
+            replayed.flush();
+
+            auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+            std::string_view v;
+            for (int i = 0; i < 2000; i++) {
+                if (!wdb.get(txn, "j" + std::to_string(i), v)) throw std::runtime_error("write made during a flush lost");
+            }
+        }
+        std::filesystem::remove("testdb/wbuf.journal");
+    }
+
+    // Posting list intersection and union
+
+    {
+        auto txn = lmdb::txn::begin(env);
+        auto idx = lmdb::dbi::open(txn, "postings", MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED | MDB_INTEGERDUP);
+
+        for (uint32_t i = 1; i <= 100; i++) {
+            if (i % 2 == 0) idx.put(txn, "two", lmdb::to_sv(i));
+            if (i % 3 == 0) idx.put(txn, "three", lmdb::to_sv(i));
+            if (i % 5 == 0) idx.put(txn, "five", lmdb::to_sv(i));
+        }
+        idx.put(txn, "single", lmdb::to_sv<uint32_t>(60));
+
+        auto collect = [&](bool intersect, const std::vector<std::string_view> &keys) {
+            std::vector<uint32_t> out;
+            auto fn = [&](std::string_view v) { out.push_back(lmdb::from_sv<uint32_t>(v)); };
+            if (intersect) lmdb::posting_list::intersect(txn, idx, keys, fn);
+            else lmdb::posting_list::unite(txn, idx, keys, fn);
+            return out;
+        };
+
+        if (collect(true, { "two", "three", "five" }) != std::vector<uint32_t>{ 30, 60, 90 }) throw std::runtime_error("bad intersection");
+        if (collect(true, { "five", "single", "two" }) != std::vector<uint32_t>{ 60 }) throw std::runtime_error("bad intersection with single value");
+        if (!collect(true, { "two", "missing" }).empty()) throw std::runtime_error("bad intersection with missing key");
+        if (collect(false, { "three", "five" }).size() != 33 + 20 - 6) throw std::runtime_error("bad union");
+
+        auto list = lmdb::posting_list::open(txn, idx, "three");
+        if (list.count() != 33) throw std::runtime_error("bad posting list count");
+        if (!list.seek(lmdb::to_sv<uint32_t>(50)) || lmdb::from_sv<uint32_t>(list.value()) != 51) throw std::runtime_error("bad posting list seek");
+        if (!list.seek(lmdb::to_sv<uint32_t>(10)) || lmdb::from_sv<uint32_t>(list.value()) != 51) throw std::runtime_error("posting list seek moved backwards");
+        if (list.seek(lmdb::to_sv<uint32_t>(101))) throw std::runtime_error("bad posting list seek past end");
+
+        std::vector<uint32_t> dups;
+        lmdb::posting_list::unite(txn, mydbdups, { "blah", "aaaa" }, [&](std::string_view v) { dups.push_back(v.size()); });
+        if (dups.size() != 3) throw std::runtime_error("bad union over variable-size dups");
+
+        mydbdups.put(txn, "withempty", "");
+        mydbdups.put(txn, "withempty", "x");
+        auto withEmpty = lmdb::posting_list::open(txn, mydbdups, "withempty");
+        if (!withEmpty.valid() || withEmpty.value() != "") throw std::runtime_error("bad empty dup value");
+        if (!withEmpty.next() || withEmpty.value() != "x" || withEmpty.next()) throw std::runtime_error("bad posting list over an empty dup value");
+
+        txn.abort();
+    }
+
+    // Range estimation and split points
+
+    {
+        auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+
+        if (mydb.estimate(txn) != mydb.size(txn)) throw std::runtime_error("bad full range estimate");
+        if (mydb.estimate(txn, "a", "z") > mydb.size(txn)) throw std::runtime_error("bad range estimate");
+        if (mydb.estimate(txn, "z", "a") != 0) throw std::runtime_error("bad empty range estimate");
+
+        size_t actual = 0;
+        {
+            auto c = lmdb::cursor::open(txn, mydb);
+            std::string_view k{"a"};
+            for (bool found = c.get(k, MDB_SET_RANGE); found && k < "z"; found = c.get(k, MDB_NEXT)) actual++;
+        }
+        auto bounds = mydb.estimate_bounds(txn, "a", "z");
+        if (bounds.min > actual || actual > bounds.max || bounds.count < bounds.min || bounds.count > bounds.max) throw std::runtime_error("range estimate out of its bounds");
+
+        auto splits = mydb.split_points(txn, 4);
+        if (splits.size() > 3 || !std::is_sorted(splits.begin(), splits.end())) throw std::runtime_error("bad split points");
+        if (!mydb.split_points(txn, 1).empty()) throw std::runtime_error("bad single split");
+    }
+
+    {
+        // In a write transaction, with a non-byte-wise key order
+        auto txn = lmdb::txn::begin(env);
+        auto rdb = lmdb::dbi::open(txn, "reversed", MDB_CREATE | MDB_REVERSEKEY);
+        for (int i = 0; i < 100; i++) rdb.put(txn, "k" + std::to_string(1000 + i), "v");
+
+        auto bounds = rdb.estimate_bounds(txn, "k1010", "k1001");
+        if (bounds.max < 9 || bounds.min > 9) throw std::runtime_error("bad reverse-key estimate");
+        if (rdb.estimate(txn, "k1001", "k1010") != 0) throw std::runtime_error("bad empty reverse-key estimate");
+
+        auto splits = rdb.split_points(txn, 4);
+        if (splits != std::vector<std::string>{"k1052", "k1005", "k1057"}) throw std::runtime_error("bad split points in a write transaction");
+        txn.abort();
+    }
+
+    // Binary dump and load
+
+    {
+        lmdb::dump_options opts;
+        opts.threads = 2;
+        opts.block_bytes = 16;
+        opts.compress = [](std::string_view raw) { return std::string(raw.rbegin(), raw.rend()); };
+        opts.decompress = [](std::string_view stored, size_t) { return std::string(stored.rbegin(), stored.rend()); };
+
+        std::string dump;
+        size_t exported = lmdb::export_dump(env, [&](std::string_view chunk) { dump += chunk; }, {}, opts);
+        if (exported == 0) throw std::runtime_error("nothing exported");
+
+        std::filesystem::remove_all("testdb_import/");
+        std::filesystem::create_directories("testdb_import/");
+        auto env2 = lmdb::env::create();
+        env2.set_max_dbs(64);
+        env2.open("testdb_import/", envFlags);
+
+        size_t pos = 0;
+        auto source = [&](char *buf, size_t n) {
+            n = std::min(n, dump.size() - pos);
+            std::memcpy(buf, dump.data() + pos, n);
+            pos += n;
+            return n;
+        };
+        if (lmdb::import_dump(env2, source, opts) != exported) throw std::runtime_error("bad import count");
+
+        {
+            auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+            auto txn2 = lmdb::txn::begin(env2, nullptr, MDB_RDONLY);
+            for (const char *name : { "mydb", "mydbdups" }) {
+                auto a = lmdb::cursor::open(txn, lmdb::dbi::open(txn, name));
+                auto b = lmdb::cursor::open(txn2, lmdb::dbi::open(txn2, name));
+                std::string_view ak, av, bk, bv;
+                bool aok = a.get(ak, av, MDB_FIRST), bok = b.get(bk, bv, MDB_FIRST);
+                for (; aok && bok; aok = a.get(ak, av, MDB_NEXT), bok = b.get(bk, bv, MDB_NEXT)) {
+                    if (ak != bk || av != bv) throw std::runtime_error("imported data differs");
+                }
+                if (aok || bok) throw std::runtime_error("imported data has different length");
+            }
+            if (lmdb::dbi::open(txn2, "mydbdups").flags(txn2) != lmdb::dbi::open(txn, "mydbdups").flags(txn)) throw std::runtime_error("imported flags differ");
+        }
+
+        dump[dump.size() / 2] ^= 1;
+        pos = 0;
+        bool failed = false;
+        try {
+            lmdb::import_dump(env2, source, opts);
+        } catch (const lmdb::error &) {
+            failed = true;
+        }
+        if (!failed) throw std::runtime_error("corrupted dump imported");
+
+        // A damaged block size is refused before anything is allocated
+        dump[dump.size() / 2] ^= 1;
+        dump[8 + 23] = char(0x7F);
+        pos = 0;
+        failed = false;
+        try {
+            lmdb::import_dump(env2, source, opts);
+        } catch (const lmdb::error &e) {
+            failed = e.code() == MDB_CORRUPTED;
+        }
+        if (!failed) throw std::runtime_error("oversized dump block not refused");
+
+        std::filesystem::remove_all("testdb_import/");
+
+        // A write committed during the export doesn't fail it or leak into the dump
+        size_t before;
+        {
+            auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+            before = lmdb::dbi::open(txn, "mydb").size(txn);
+        }
+        opts.range_bytes = 1;
+        bool written = false;
+        exported = lmdb::export_dump(env, [&](std::string_view) {
+            if (written) return;
+            written = true;
+            auto txn = lmdb::txn::begin(env);
+            lmdb::dbi::open(txn, "mydb").put(txn, "export-race", "x");
+            txn.commit();
+        }, {"mydb"}, opts);
+        if (exported != before) throw std::runtime_error("export saw a later write");
+        {
+            auto txn = lmdb::txn::begin(env);
+            lmdb::dbi::open(txn, "mydb").del(txn, "export-race");
+            txn.commit();
+        }
+    }
+
+    // Key and value size profiles
+
+    {
+        auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+
+        auto p = lmdb::size_profile::scan(txn, mydb);
+        if (p.entries != mydb.size(txn) || p.keys != p.entries) throw std::runtime_error("bad profile entries");
+        if (p.key_sizes.count != p.entries || p.value_sizes.min > p.value_sizes.max) throw std::runtime_error("bad profile histograms");
+        if (p.key_sizes.quantile(1.0) < p.key_sizes.max || p.dup_counts.count) throw std::runtime_error("bad profile quantile");
+        size_t prefixed = 0;
+        for (const auto &pr : p.prefixes) prefixed += pr.second;
+        if (p.prefixes.empty() || prefixed > p.keys) throw std::runtime_error("bad profile prefixes");
+
+        lmdb::size_profile_options opts;
+        opts.threads = 2;
+        opts.prefix_bytes = 1;
+        auto d = lmdb::size_profile::scan(txn, mydbdups, opts);
+        if (d.entries != mydbdups.size(txn) || d.dup_counts.total != d.entries || d.keys != d.dup_counts.count) throw std::runtime_error("bad dupsort profile");
+        if (d.overflow_values) throw std::runtime_error("dupsort values can't overflow");
+    }
+
+    {
+        // A write transaction is scanned whole, by one cursor
+        auto txn = lmdb::txn::begin(env);
+        mydb.put(txn, "profiled", "in a write txn");
+        lmdb::size_profile_options opts;
+        opts.threads = 2;
+        opts.samples = 1;
+        auto p = lmdb::size_profile::scan(txn, mydb, opts);
+        if (p.entries != mydb.size(txn)) throw std::runtime_error("bad profile in a write transaction");
+        txn.abort();
+    }
+
+    // Record expiry
+
+    {
+        using namespace std::chrono_literals;
+        auto now = lmdb::ttl_dbi::clock::now();
+        lmdb::ttl_dbi ttl;
+
+        {
+            auto txn = lmdb::txn::begin(env);
+            ttl = lmdb::ttl_dbi::open(txn, "ttldb", MDB_CREATE);
+            ttl.put(txn, "forever", "a");
+            ttl.put(txn, "expired", "b", now - 1s);
+            ttl.put(txn, "later", "c", 1h);
+            ttl.put(txn, "moved", "d", now - 2s);
+            ttl.put(txn, "moved", "e", now + 1h);
+            if (ttl.put(txn, "moved", "f", now, MDB_NOOVERWRITE)) throw std::runtime_error("ttl overwrote");
+            txn.commit();
+        }
+
+        {
+            auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+            std::string_view v;
+            if (!ttl.get(txn, "forever", v) || v != "a") throw std::runtime_error("bad ttl get");
+            if (ttl.get(txn, "expired", v)) throw std::runtime_error("expired record not filtered");
+            if (!ttl.get(txn, "expired", v, false) || v != "b") throw std::runtime_error("expired record missing before sweep");
+            lmdb::ttl_dbi::clock::time_point expires;
+            if (!ttl.get(txn, "moved", v, expires) || v != "e" || expires < now) throw std::runtime_error("bad ttl replace");
+            if (lmdb::dbi{ttl.index()}.size(txn) != 3) throw std::runtime_error("bad ttl index");
+        }
+
+        {
+            lmdb::ttl_sweeper sweeper(env, ttl, 1, 1ms, 0ms);
+            while (sweeper.passes() < 1) std::this_thread::sleep_for(1ms);
+            if (sweeper.swept() != 1) throw std::runtime_error("bad sweep count");
+        }
+
+        {
+            auto txn = lmdb::txn::begin(env);
+            std::string_view v;
+            if (ttl.get(txn, "expired", v, false)) throw std::runtime_error("expired record not swept");
+            if (ttl.sweep(txn, now + 2h) != 2) throw std::runtime_error("bad manual sweep");
+            if (!ttl.get(txn, "forever", v) || lmdb::dbi{ttl.index()}.size(txn) != 0) throw std::runtime_error("bad ttl after sweep");
+            if (!ttl.del(txn, "forever") || ttl.del(txn, "forever")) throw std::runtime_error("bad ttl del");
+            txn.abort();
+        }
+    }
+
+    // Reserved puts
+
+    {
+        auto txn = lmdb::txn::begin(env);
+        std::string_view v;
+
+        char *p = mydb.reserve(txn, "reserved", 5);
+        std::memcpy(p, "hello", 5);
+        if (!mydb.get(txn, "reserved", v) || v != "hello") throw std::runtime_error("bad reserve");
+        if (mydb.reserve(txn, "reserved", 5, MDB_NOOVERWRITE)) throw std::runtime_error("reserve overwrote");
+
+        mydb.put_reserve(txn, "filled", 3, [](char *data) { std::memcpy(data, "abc", 3); });
+        if (!mydb.get(txn, "filled", v) || v != "abc") throw std::runtime_error("bad put_reserve");
+
+        mydb.put_encoded(txn, "encoded", tagged{ 7, "seven" });
+        if (!mydb.get(txn, "encoded", v) || v != std::string_view("\x07seven")) throw std::runtime_error("bad put_encoded");
+        mydb.put_encoded(txn, "number", uint64_t(42));
+        if (!mydb.get(txn, "number", v) || lmdb::from_sv<uint64_t>(v) != 42) throw std::runtime_error("bad trivially copyable put_encoded");
+        const char *cstr = "c string";
+        mydb.put_encoded(txn, "cstring", cstr);
+        if (!mydb.get(txn, "cstring", v) || v != "c string") throw std::runtime_error("bad C string put_encoded");
+
+        {
+            auto cur = lmdb::cursor::open(txn, mydb);
+            cur.put_encoded("cursorenc", std::string("via cursor"));
+            std::string_view k;
+            if (!cur.get(k, v, MDB_GET_CURRENT) || k != "cursorenc" || v != "via cursor") throw std::runtime_error("bad cursor put_encoded");
+            if (cur.put_reserve("cursorenc", 1, [](char *) {}, MDB_NOOVERWRITE)) throw std::runtime_error("cursor reserve overwrote");
+        }
+
+        txn.abort();
+    }
+
+    // In-place updates
+
+    {
+        auto txn = lmdb::txn::begin(env);
+        mydb.put(txn, "counter", lmdb::to_sv<uint64_t>(41));
+        if (!mydb.update<uint64_t>(txn, "counter", [](uint64_t &n) { n++; })) throw std::runtime_error("update missed key");
+        std::string_view v;
+        if (!mydb.get(txn, "counter", v) || lmdb::from_sv<uint64_t>(v) != 42) throw std::runtime_error("bad update");
+        if (mydb.update<uint64_t>(txn, "nocounter", [](uint64_t &) {})) throw std::runtime_error("update found missing key");
+
+        bool failed = false;
+        try {
+            mydb.update<uint32_t>(txn, "counter", [](uint32_t &) {});
+        } catch (const lmdb::error &) {
+            failed = true;
+        }
+        if (!failed) throw std::runtime_error("update with wrong size accepted");
+        txn.abort();
+    }
+
+    {
+        // A value larger than the node max lives on overflow pages, which are clean in a fresh txn
+        struct big { uint64_t n; char pad[3000]; };
+        big b{};
+        b.n = 7;
+        auto txn = lmdb::txn::begin(env);
+        mydb.put(txn, "bigcounter", lmdb::to_sv(b));
+        txn.commit();
+
+        txn = lmdb::txn::begin(env);
+        if (!mydb.update<big>(txn, "bigcounter", [](big &x) { x.n++; })) throw std::runtime_error("update missed big key");
+        std::string_view v;
+        if (!mydb.get(txn, "bigcounter", v) || v.size() != sizeof(big)) throw std::runtime_error("bad big update");
+        big out;
+        std::memcpy(&out, v.data(), sizeof(big));
+        if (out.n != 8 || out.pad[0] != 0 || out.pad[2999] != 0) throw std::runtime_error("big update corrupted the value");
+        mydb.del(txn, "bigcounter");
+        txn.commit();
+    }
+
+    // Range and prefix deletion
+
+    {
+        {
+            auto txn = lmdb::txn::begin(env);
+            auto rdb = lmdb::dbi::open(txn, "rangedb", MDB_CREATE);
+            auto rdups = lmdb::dbi::open(txn, "rangedups", MDB_CREATE | MDB_DUPSORT);
+            for (const char *k : { "a1", "a2", "b1", "b2", "b3", "b\xff", "c1" }) rdb.put(txn, k, "v");
+            for (const char *v : { "x", "y", "z" }) rdups.put(txn, "k1", v), rdups.put(txn, "k2", v), rdups.put(txn, "k3", v);
+            txn.commit();
+        }
+
+        auto txn = lmdb::txn::begin(env);
+        auto rdb = lmdb::dbi::open(txn, "rangedb");
+        auto rdups = lmdb::dbi::open(txn, "rangedups");
+        std::string_view v;
+
+        if (lmdb::dbi::prefix_end("b") != "c" || lmdb::dbi::prefix_end("a\xff\xff") != "b" || !lmdb::dbi::prefix_end("\xff").empty()) throw std::runtime_error("bad prefix_end");
+        if (rdb.delete_prefix(txn, "b") != 4 || rdb.get(txn, "b2", v) || !rdb.get(txn, "c1", v) || rdb.size(txn) != 3) throw std::runtime_error("bad delete_prefix");
+        if (rdb.delete_range(txn, "a2", "zz") != 2 || rdb.size(txn) != 1) throw std::runtime_error("bad delete_range");
+        if (rdb.delete_range(txn, "x", "y") != 0) throw std::runtime_error("bad empty delete_range");
+        if (rdups.delete_range(txn, "k2", "k3") != 3 || rdups.size(txn) != 6 || rdups.get(txn, "k2", v)) throw std::runtime_error("bad dupsort delete_range");
+        if (rdups.delete_range(txn) != 6 || rdups.size(txn) != 0) throw std::runtime_error("bad whole-database delete_range");
+        txn.commit();
+
+        if (rdb.delete_range(env, {}, {}, 1) != 1) throw std::runtime_error("bad batched delete_range");
+        {
+            auto t = lmdb::txn::begin(env);
+            for (int i = 0; i < 10; i++) rdb.put(t, "p" + std::to_string(i), "v");
+            rdb.put(t, "q", "v");
+            t.commit();
+        }
+        if (rdb.delete_prefix(env, "p", 3) != 10) throw std::runtime_error("bad batched delete_prefix");
+        auto t = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        if (rdb.size(t) != 1) throw std::runtime_error("batched delete_prefix removed too much");
+    }
+
+    // Range digests
+
+    {
+        auto txn = lmdb::txn::begin(env);
+        auto ra = lmdb::dbi::open(txn, "replica_a", MDB_CREATE);
+        auto rb = lmdb::dbi::open(txn, "replica_b", MDB_CREATE);
+        for (int i = 0; i < 2000; i++) {
+            char key[16];
+            std::snprintf(key, sizeof(key), "k%04d", i);
+            ra.put(txn, key, std::to_string(i));
+            rb.put(txn, key, std::to_string(i));
+        }
+        rb.put(txn, "k0500", "changed");
+        rb.del(txn, "k1234");
+        rb.put(txn, "k1234x", "added");
+
+        lmdb::digest_options opts;
+        opts.leaf_entries = 16;
+        opts.threads = 2;
+        // A write transaction is scanned by one cursor, as other threads can't see it
+        auto written = lmdb::digest_tree::compute(txn, ra, opts);
+        lmdb::digest_cache cache;
+        if (cache.get(txn, ra, opts).root().count != 2000) throw std::runtime_error("bad digest in a write transaction");
+        ra.put(txn, "k9999", "after");
+        if (cache.get(txn, ra, opts).root().count != 2001) throw std::runtime_error("stale digest in a write transaction");
+        ra.del(txn, "k9999");
+        txn.commit();
+
+        txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        auto da = lmdb::digest_tree::compute(txn, ra, opts);
+        auto db = lmdb::digest_tree::compute(txn, rb, opts);
+        if (da.root().count != 2000 || db.root().count != 2000) throw std::runtime_error("bad digest count");
+        if (!da.diff(written).empty() || !da.diff(lmdb::digest_tree::compute(txn, ra)).empty()) throw std::runtime_error("identical digests differ");
+
+        auto covered = [](const std::vector<lmdb::digest_tree::range> &ranges, std::string_view key) {
+            for (const auto &r : ranges) if (key >= r.first && (r.second.empty() || key < r.second)) return true;
+            return false;
+        };
+        opts.leaf_entries = 1000;
+        for (const auto &ranges : { da.diff(db), db.diff(da), lmdb::digest_tree::compute(txn, ra, opts).diff(db) }) {
+            for (const char *k : { "k0500", "k1234", "k1234x" }) {
+                if (!covered(ranges, k)) throw std::runtime_error("difference not found by digest");
+            }
+        }
+        auto ranges = da.diff(db);
+        size_t inRanges = 0;
+        for (int i = 0; i < 2000; i++) {
+            char key[16];
+            std::snprintf(key, sizeof(key), "k%04d", i);
+            inRanges += covered(ranges, key);
+        }
+        if (inRanges > 64) throw std::runtime_error("digest ranges too coarse");
+
+        auto decoded = lmdb::digest_tree::decode(db.encode());
+        if (decoded.nodes() != db.nodes() || decoded.txnid() != db.txnid() || !decoded.diff(db).empty()) throw std::runtime_error("bad digest encoding");
+
+        if (&cache.get(txn, ra) != &cache.get(txn, ra)) throw std::runtime_error("digest not cached");
+        if (&cache.get(txn, ra, opts) == &cache.get(txn, ra) || cache.get(txn, ra, opts).nodes() == cache.get(txn, ra).nodes()) throw std::runtime_error("digest cached across options");
+        txn.abort();
+
+        txn = lmdb::txn::begin(env);
+        ra.drop(txn, true);
+        rb.drop(txn, true);
+        txn.commit();
+    }
+
+    // Queues
+
+    {
+        auto txn = lmdb::txn::begin(env);
+        auto q = lmdb::queue::open(txn, "queue", MDB_CREATE);
+        if (q.size(txn) != 0 || q.head(txn) != 0 || q.tail(txn) != 0) throw std::runtime_error("bad empty queue");
+
+        std::vector<std::string> batch;
+        for (int i = 0; i < 300; i++) batch.push_back("job" + std::to_string(i));
+        if (q.push(txn, batch.begin(), batch.end()) != 0 || q.push(txn, "last") != 300) throw std::runtime_error("bad queue push");
+        if (q.size(txn) != 301 || q.tail(txn) != 301) throw std::runtime_error("bad queue size");
+
+        std::vector<std::string> popped;
+        if (q.pop(txn, 2, [&](size_t, std::string_view v) { popped.emplace_back(v); }) != 2) throw std::runtime_error("bad queue pop count");
+        if (popped != std::vector<std::string>{ "job0", "job1" } || q.head(txn) != 2) throw std::runtime_error("bad queue pop");
+
+        size_t lastSeq = 0;
+        if (q.read(txn, "indexer", 256, [&](size_t seq, std::string_view) { lastSeq = seq; }) != 256 || lastSeq != 257) throw std::runtime_error("bad group read");
+        q.ack(txn, "indexer", lastSeq);
+        q.ack(txn, "indexer", 5);
+        if (q.offset(txn, "indexer") != 258 || q.offset(txn, "mailer") != 2) throw std::runtime_error("bad group offset");
+        if (q.trim(txn) != 256 || q.size(txn) != 43) throw std::runtime_error("bad trim without all groups");
+
+        q.ack(txn, "mailer", 10);
+        if (q.trim(txn) != 0) throw std::runtime_error("trim passed a slow group");
+        q.remove_group(txn, "mailer");
+        q.ack(txn, "indexer", 300);
+        if (q.trim(txn) != 43 || q.size(txn) != 0 || q.tail(txn) != 301) throw std::runtime_error("bad final trim");
+
+        // Sequence numbers aren't reused once the queue drains, with or without groups
+        if (q.push(txn, "after trim") != 301 || q.pop(txn, 10) != 1 || q.push(txn, "after pop") != 302) throw std::runtime_error("queue reused a sequence number");
+        q.remove_group(txn, "indexer");
+        if (q.pop(txn, 10) != 1 || q.tail(txn) != 303 || q.head(txn) != 303) throw std::runtime_error("bad drained queue");
+
+        // Reserved group names can't touch the sequence number
+        const std::string_view next{"\0next", 5};
+        bool refused = false;
+        try {
+            q.ack(txn, next, 1000);
+        } catch (const lmdb::error &e) {
+            refused = e.code() == MDB_BAD_VALSIZE;
+        }
+        if (!refused || q.tail(txn) != 303) throw std::runtime_error("reserved group name accepted");
+        txn.abort();
+    }
+
+    // Sequences
+
+    {
+        lmdb::dbi seqdb;
+        {
+            auto txn = lmdb::txn::begin(env);
+            seqdb = lmdb::dbi::open(txn, "sequences", MDB_CREATE);
+            txn.commit();
+        }
+
+        lmdb::sequence a(env, seqdb, "ids", 4, 1024);
+        lmdb::sequence b(env, seqdb, "ids", 4, 1024);
+        std::vector<std::vector<size_t>> got(4);
+        {
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < got.size(); t++) {
+                threads.emplace_back([&, t] {
+                    for (int i = 0; i < 2000; i++) got[t].push_back((t % 2 ? b : a).next());
+                });
+            }
+            for (auto &t : threads) t.join();
+        }
+
+        std::vector<size_t> all;
+        for (const auto &g : got) {
+            if (!std::is_sorted(g.begin(), g.end())) throw std::runtime_error("sequence not increasing within a thread");
+            all.insert(all.end(), g.begin(), g.end());
+        }
+        std::sort(all.begin(), all.end());
+        if (std::adjacent_find(all.begin(), all.end()) != all.end()) throw std::runtime_error("sequence handed out an ID twice");
+        if (a.block_size() <= 4) throw std::runtime_error("sequence block size didn't adapt");
+
+        auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        if (a.high_water(txn) <= all.back()) throw std::runtime_error("bad sequence high-water mark");
+    }
+
+    // Optimistic transactions
+
+    {
+        lmdb::dbi odb;
+        {
+            auto txn = lmdb::txn::begin(env);
+            odb = lmdb::dbi::open(txn, "optimistic", MDB_CREATE);
+            odb.put(txn, "counter", lmdb::to_sv<uint64_t>(0));
+            txn.commit();
+        }
+
+        auto increment = [&](lmdb::optimistic_txn &t) {
+            std::string_view v;
+            if (!t.get(odb, "counter", v)) throw std::runtime_error("optimistic counter missing");
+            uint64_t n = lmdb::from_sv<uint64_t>(v) + 1;
+            t.put(odb, "counter", lmdb::to_sv(n));
+            if (!t.get(odb, "counter", v) || lmdb::from_sv<uint64_t>(v) != n) throw std::runtime_error("optimistic txn doesn't see its writes");
+            return n;
+        };
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&] {
+                for (int i = 0; i < 50; i++) lmdb::optimistic_txn::run(env, increment);
+            });
+        }
+        for (auto &t : threads) t.join();
+        {
+            auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+            std::string_view v;
+            if (!odb.get(txn, "counter", v) || lmdb::from_sv<uint64_t>(v) != 200) throw std::runtime_error("optimistic increments lost");
+        }
+
+        int attempts = 0;
+        uint64_t result = lmdb::optimistic_txn::run(env, [&](lmdb::optimistic_txn &t) {
+            if (attempts++ == 0) {
+                // A write committed between the read and the validation forces a retry
+                std::thread([&] {
+                    auto txn = lmdb::txn::begin(env);
+                    odb.put(txn, "counter", lmdb::to_sv<uint64_t>(1000));
+                    txn.commit();
+                }).join();
+            }
+            t.del(odb, "gone");
+            return increment(t);
+        });
+        if (attempts != 2 || result != 1001) throw std::runtime_error("optimistic conflict not retried");
+
+        uint64_t last = lmdb::optimistic_txn::run(env, increment, 1);
+        auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        std::string_view v;
+        if (last != 1002 || !odb.get(txn, "counter", v) || lmdb::from_sv<uint64_t>(v) != 1002) throw std::runtime_error("bad optimistic result");
+    }
+
+    // Skip scans
+
+    {
+        auto txn = lmdb::txn::begin(env);
+        auto events = lmdb::dbi::open(txn, "events", MDB_CREATE);
+        auto composite = [](uint32_t tenant, uint32_t ts) {
+            std::string key(8, '\0');
+            for (int i = 0; i < 4; i++) key[i] = char(tenant >> (24 - 8 * i)), key[4 + i] = char(ts >> (24 - 8 * i));
+            return key;
+        };
+        for (uint32_t tenant = 0; tenant < 10; tenant++) {
+            for (uint32_t ts = 0; ts < 100; ts++) events.put(txn, composite(tenant, ts), "e");
+        }
+        events.put(txn, composite(0xFFFFFFFF, 22), "last");
+
+        auto suffix = [&](uint32_t ts) { return composite(0, ts).substr(4); };
+        auto scan = lmdb::skip_scan::open(txn, events, lmdb::skip_scan::by<lmdb::cmp::big_endian<uint32_t>>(), suffix(20), suffix(25));
+        std::string_view k, v;
+        size_t n = 0;
+        while (scan.get(k, v)) {
+            if (k.substr(4) < suffix(20) || k.substr(4) >= suffix(25)) throw std::runtime_error("skip scan returned a key out of range");
+            n++;
+        }
+        if (n != 51 || scan.get(k, v)) throw std::runtime_error("bad skip scan count");
+        if (scan.seeks() > 25) throw std::runtime_error("skip scan didn't skip");
+
+        auto open = lmdb::skip_scan::open(txn, events, lmdb::skip_scan::fixed(4), {}, suffix(2));
+        n = 0;
+        while (open.get(k, v)) n++;
+        if (n != 20) throw std::runtime_error("bad skip scan without lower bound");
+
+        auto tail = lmdb::skip_scan::open(txn, events, lmdb::skip_scan::fixed(4), suffix(98), {});
+        n = 0;
+        while (tail.get(k, v)) n++;
+        if (n != 20) throw std::runtime_error("bad skip scan without upper bound");
+        txn.abort();
+    }
+
+    // Aggregate views
+
+    {
+        auto txn = lmdb::txn::begin(env);
+        auto orders = lmdb::aggregate_dbi::open(txn, "orders", MDB_CREATE);
+        auto amount = [](std::string_view, std::string_view val) { return int64_t(std::stoll(std::string(val))); };
+        orders.add_view("by_region", 3, amount);
+        size_t grouped = 0;
+        orders.add_view("large", [&](std::string_view, std::string_view val) -> std::optional<std::string> {
+            grouped++;
+            if (val.size() < 3) return std::nullopt;
+            return "all";
+        });
+
+        orders.put(txn, "eu/1", "10");
+        orders.put(txn, "eu/2", "250");
+        orders.put(txn, "eu/3", "40");
+        orders.put(txn, "us/1", "500");
+        if (orders.put(txn, "us/1", "7", MDB_NOOVERWRITE)) throw std::runtime_error("aggregate put overwrote");
+
+        auto eu = orders.get(txn, "by_region", "eu/");
+        if (eu.count != 3 || eu.sum != 300 || eu.min != 10 || eu.max != 250) throw std::runtime_error("bad aggregate after puts");
+        if (orders.get(txn, "large", "all").count != 2) throw std::runtime_error("bad extractor aggregate");
+
+        orders.put(txn, "eu/2", "5");
+        orders.del(txn, "eu/1");
+        eu = orders.get(txn, "by_region", "eu/");
+        if (eu.count != 2 || eu.sum != 45 || eu.min != 5 || eu.max != 40) throw std::runtime_error("bad aggregate after update and delete");
+        if (orders.get(txn, "large", "all").count != 1) throw std::runtime_error("bad extractor aggregate after update");
+
+        orders.del(txn, "us/1");
+        if (orders.get(txn, "by_region", "us/").count != 0) throw std::runtime_error("empty group not removed");
+
+        // Ties and overwrites of an extremum don't rescan
+        orders.put(txn, "eu/4", "5");
+        orders.put(txn, "eu/3", "45");
+        orders.put(txn, "eu/3", "60");
+        orders.del(txn, "eu/2");
+        eu = orders.get(txn, "by_region", "eu/");
+        if (eu.count != 2 || eu.sum != 65 || eu.min != 5 || eu.max != 60) throw std::runtime_error("bad aggregate after ties and overwrites");
+        orders.put(txn, "eu/3", "30");
+        eu = orders.get(txn, "by_region", "eu/");
+        if (eu.count != 2 || eu.sum != 35 || eu.max != 30) throw std::runtime_error("bad aggregate after lowering the maximum");
+
+        orders.put(txn, "us/2", "1000");
+        orders.put(txn, "us/3", "2000");
+        grouped = 0;
+        orders.put(txn, "us/2", "1500");
+        orders.del(txn, "us/3");
+        if (grouped != 3) throw std::runtime_error("count-only view rescanned");
+        if (orders.get(txn, "large", "all").count != 1) throw std::runtime_error("bad count-only aggregate");
+        orders.del(txn, "us/2");
+
+        orders.add_view("by_id", [](std::string_view key, std::string_view) { return std::optional<std::string>(key.substr(3)); }, amount);
+        orders.rebuild(txn, "by_id");
+        std::vector<std::string> groups;
+        orders.each(txn, "by_id", [&](std::string_view group, const lmdb::aggregate& a) {
+            groups.emplace_back(group);
+            if (a.count != 1) throw std::runtime_error("bad rebuilt aggregate");
+        });
+        if (groups != std::vector<std::string>{"3", "4"}) throw std::runtime_error("bad aggregate groups");
+        txn.abort();
+    }
+
+    // Sorted batch puts
+
+    {
+        auto txn = lmdb::txn::begin(env);
+        auto bdb = lmdb::dbi::open(txn, "batch", MDB_CREATE);
+        bdb.put(txn, "m", "existing");
+
+        std::vector<std::string> keys, vals;
+        std::map<std::string, std::string> expected{{"m", "existing"}};
+        uint64_t x = 12345;
+        for (int i = 0; i < 2000; i++) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            keys.push_back(std::string(1, char('a' + (x >> 60))) + std::to_string(x >> 52));
+            vals.push_back(std::to_string(i));
+            expected[keys.back()] = vals.back();
+        }
+
+        std::vector<std::pair<std::string_view, std::string_view>> batch;
+        for (size_t i = 0; i < keys.size(); i++) batch.emplace_back(keys[i], vals[i]);
+        size_t stored = bdb.put_batch(txn, batch);
+        if (stored != expected.size() - 1) throw std::runtime_error("bad put_batch count");
+
+        auto cursor = lmdb::cursor::open(txn, bdb);
+        std::string_view k, v;
+        auto it = expected.begin();
+        for (bool found = cursor.get(k, v, MDB_FIRST); found; found = cursor.get(k, v, MDB_NEXT), ++it) {
+            if (it == expected.end() || k != it->first || v != it->second) throw std::runtime_error("bad put_batch contents");
+        }
+        if (it != expected.end()) throw std::runtime_error("put_batch lost keys");
+
+        // Keys past the end are appended; existing keys are left alone with MDB_NOOVERWRITE
+        stored = bdb.put_batch(txn, {{"zz2", "2"}, {"zz1", "1"}, {"m", "changed"}, {"zz1", "1b"}}, MDB_NOOVERWRITE);
+        if (stored != 2) throw std::runtime_error("bad put_batch count with MDB_NOOVERWRITE");
+        if (!bdb.get(txn, "zz1", v) || v != "1b" || !bdb.get(txn, "m", v) || v != "existing") throw std::runtime_error("bad put_batch append");
+
+        auto ddb = lmdb::dbi::open(txn, "batch-dups", MDB_CREATE | MDB_DUPSORT);
+        if (ddb.put_batch(txn, {{"b", "2"}, {"a", "1"}, {"b", "1"}}) != 3 || ddb.size(txn) != 3) throw std::runtime_error("bad dupsort put_batch");
+        if (ddb.put_batch(txn, {{"a", "1"}, {"c", "3"}, {"c", "3"}}) != 1 || ddb.size(txn) != 4) throw std::runtime_error("bad dupsort put_batch of existing pairs");
+
+        // Long shared prefixes don't recurse once per byte
+        std::vector<std::string> deep;
+        for (int i = 0; i < 64; i++) deep.push_back(std::string(480, 'p') + std::to_string((i * 37) % 64));
+        batch.clear();
+        for (const auto &d : deep) batch.emplace_back(d, "deep");
+        if (bdb.put_batch(txn, batch) != deep.size()) throw std::runtime_error("bad put_batch of long keys");
+        txn.abort();
+    }
+
+    // Chunked blobs
+
+    {
+        std::string big;
+        for (size_t i = 0; i < 10000; i++) big += char('a' + i % 26);
+
+        auto txn = lmdb::txn::begin(env);
+        auto blobs = lmdb::blob_store::open(txn, "blobs", MDB_CREATE);
+        if (blobs.chunk_size(txn, "big") >= 4096) throw std::runtime_error("blob chunks don't fit a leaf");
+
+        size_t pos = 0;
+        size_t written = blobs.write(txn, "big", [&](char *buf, size_t n) {
+            n = std::min({ n, big.size() - pos, size_t(777) });
+            std::memcpy(buf, big.data() + pos, n);
+            pos += n;
+            return n;
+        });
+        if (written != big.size()) throw std::runtime_error("bad blob write size");
+        const std::string between("big\0\0\0\1", 7);  // its chunks sort between those of "big"
+        blobs.put(txn, between, "interleaved");
+        blobs.put(txn, "empty", "");
+
+        std::string out;
+        size_t size = 0, pieces = 0;
+        if (!blobs.size(txn, "big", size) || size != big.size()) throw std::runtime_error("bad blob size");
+        if (!blobs.read(txn, "big", [&](std::string_view piece) { out += piece; pieces++; }) || out != big) throw std::runtime_error("bad blob read");
+        if (pieces < 2 || pieces != lmdb::dbi{blobs.handle()}.size(txn) - 4) throw std::runtime_error("bad blob chunking");
+        if (!blobs.get(txn, "big", out, 3000, 5000) || out != big.substr(3000, 5000)) throw std::runtime_error("bad blob range read");
+        if (!blobs.get(txn, "big", out, 9990) || out != big.substr(9990)) throw std::runtime_error("bad blob tail read");
+        if (!blobs.get(txn, "empty", out) || !out.empty()) throw std::runtime_error("bad empty blob");
+        if (blobs.get(txn, "missing", out)) throw std::runtime_error("missing blob found");
+
+        blobs.put(txn, "big", "small");
+        if (!blobs.get(txn, "big", out) || out != "small" || lmdb::dbi{blobs.handle()}.size(txn) != 5) throw std::runtime_error("bad blob replace");
+        if (!blobs.del(txn, "big") || blobs.del(txn, "big") || !blobs.get(txn, between, out) || out != "interleaved") throw std::runtime_error("bad blob del");
+        txn.abort();
+    }
+
+    // Database names and page-cache residency
+
+    {
+        auto txn = lmdb::txn::begin(env);
+        lmdb::dbi::open(txn, nullptr).put(txn, "plainkey", "notadb");
+
+        auto names = lmdb::dbi::names(txn);
+        if (std::find(names.begin(), names.end(), "mydb") == names.end()) throw std::runtime_error("names missing mydb");
+        if (std::find(names.begin(), names.end(), "mydbdups") == names.end()) throw std::runtime_error("names missing mydbdups");
+        if (std::find(names.begin(), names.end(), "plainkey") != names.end()) throw std::runtime_error("names has plain key");
+
+        txn.abort();
+    }
+
+    {
+        // Residency reads the map, so it needs a read-only snapshot
+        auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        env.prefetch(txn, mydb);
+        auto cursor = lmdb::cursor::open(txn, mydb);
+        std::string_view k, v;
+        volatile char touched = 0;
+        for (bool found = cursor.get(k, v, MDB_FIRST); found; found = cursor.get(k, v, MDB_NEXT)) {
+            for (char c : v) touched = touched ^ c;
+        }
+
+        auto stat = mydb.residency(txn, 4);
+        if (stat.histogram.size() > 4) throw std::runtime_error("bad residency histogram");
+        for (const auto &b : stat.histogram) {
+            if (b.resident != b.pages) throw std::runtime_error("touched bucket not resident");
+        }
+        // Every page of the database was just read, so all of them are in the page cache
+        if (stat.branch_resident != stat.branch_pages || stat.leaf_resident != stat.leaf_pages || stat.overflow_resident != stat.overflow_pages) throw std::runtime_error("touched pages not resident");
+        if (stat.resident_bytes() != (stat.branch_pages + stat.leaf_pages + stat.overflow_pages) * stat.psize) throw std::runtime_error("bad residency bytes");
+    }
+
+
+
     if (0) {
         // This test case is not enabled by default because it causes the process
         // to crash. See the "Cursor double-free issue" section in README.md
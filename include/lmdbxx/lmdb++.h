@@ -28,12 +28,45 @@
 #endif
 #include <cstddef>     /* for std::size_t */
 #include <cstdio>      /* for std::snprintf() */
-#include <cstring>     /* for std::memcpy() */
+#include <cstring>     /* for std::memcpy(), std::strlen() */
 #include <stdexcept>   /* for std::runtime_error */
 #include <string>      /* for std::string */
 #include <string_view> /* for std::string_view */
 #include <limits>      /* for std::numeric_limits<> */
+#include <map>         /* for std::map<> */
+#include <optional>    /* for std::optional<> */
+#include <shared_mutex> /* for std::shared_mutex */
 #include <memory>      /* for std::addressof */
+#include <type_traits> /* for std::is_integral_v<>, std::make_unsigned_t<>, std::is_trivially_copyable_v<> */
+#include <algorithm>   /* for std::min() */
+#include <array>       /* for std::array<> */
+#include <atomic>      /* for std::atomic<> */
+#include <cerrno>      /* for errno */
+#include <chrono>      /* for std::chrono::* */
+#include <climits>     /* for INT_MAX */
+#include <condition_variable> /* for std::condition_variable */
+#include <cstdint>     /* for std::uint32_t, std::uint64_t */
+#include <cstdlib>     /* for std::strtoull() */
+#include <deque>       /* for std::deque<> */
+#include <exception>   /* for std::exception_ptr */
+#include <filesystem>  /* for std::filesystem::create_directories() */
+#include <functional>  /* for std::function<> */
+#include <future>      /* for std::async() */
+#include <iterator>    /* for std::back_inserter() */
+#include <mutex>       /* for std::mutex */
+#include <thread>      /* for std::thread */
+#include <tuple>       /* for std::tuple<> */
+#include <vector>      /* for std::vector */
+
+#ifndef _WIN32
+#include <fcntl.h>     /* for ::open() */
+#include <sys/mman.h>  /* for ::mmap(), ::munmap() */
+#include <unistd.h>    /* for ::close(), ::ftruncate() */
+#endif
+#ifdef __linux__
+#include <linux/futex.h> /* for FUTEX_WAIT, FUTEX_WAKE */
+#include <sys/syscall.h> /* for SYS_futex */
+#endif
 
 namespace lmdb {
   using mode = mdb_mode_t;
@@ -256,7 +289,7 @@ namespace lmdb {
   static inline void* env_get_userctx(MDB_env* env);
 #endif
   // TODO: mdb_env_set_assert()
-  // TODO: mdb_reader_list()
+  static inline void reader_list(MDB_env* env, MDB_msg_func* func, void* ctx);
   static inline void reader_check(MDB_env *env, int *dead);
 }
 
@@ -518,6 +551,20 @@ lmdb::env_get_userctx(MDB_env* const env) {
 }
 #endif
 
+/**
+ * @throws lmdb::error on failure
+ * @see http://symas.com/mdb/doc/group__mdb.html
+ */
+static inline void
+lmdb::reader_list(MDB_env* const env,
+                  MDB_msg_func* const func,
+                  void* const ctx) {
+  const int rc = ::mdb_reader_list(env, func, ctx);
+  if (rc != MDB_SUCCESS) {
+    error::raise("mdb_reader_list", rc);
+  }
+}
+
 static inline void
 lmdb::reader_check(MDB_env *env, int *dead) {
   const int rc = ::mdb_reader_check(env, dead);
@@ -632,8 +679,8 @@ namespace lmdb {
   static inline bool dbi_get(MDB_txn* txn, MDB_dbi dbi, const MDB_val* key, MDB_val* data);
   static inline bool dbi_put(MDB_txn* txn, MDB_dbi dbi, const MDB_val* key, MDB_val* data, unsigned int flags);
   static inline bool dbi_del(MDB_txn* txn, MDB_dbi dbi, const MDB_val* key, const MDB_val* data);
-  // TODO: mdb_cmp()
-  // TODO: mdb_dcmp()
+  static inline int dbi_cmp(MDB_txn* txn, MDB_dbi dbi, const MDB_val* a, const MDB_val* b) noexcept;
+  static inline int dbi_dcmp(MDB_txn* txn, MDB_dbi dbi, const MDB_val* a, const MDB_val* b) noexcept;
 }
 
 /**
@@ -809,6 +856,28 @@ lmdb::dbi_del(MDB_txn* const txn,
   return (rc == MDB_SUCCESS);
 }
 
+/**
+ * @see http://symas.com/mdb/doc/group__mdb.html
+ */
+static inline int
+lmdb::dbi_cmp(MDB_txn* const txn,
+              const MDB_dbi dbi,
+              const MDB_val* const a,
+              const MDB_val* const b) noexcept {
+  return ::mdb_cmp(txn, dbi, a, b);
+}
+
+/**
+ * @see http://symas.com/mdb/doc/group__mdb.html
+ */
+static inline int
+lmdb::dbi_dcmp(MDB_txn* const txn,
+               const MDB_dbi dbi,
+               const MDB_val* const a,
+               const MDB_val* const b) noexcept {
+  return ::mdb_dcmp(txn, dbi, a, b);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /* Procedural Interface: Cursors */
 
@@ -933,11 +1002,464 @@ lmdb::cursor_count(MDB_cursor* const cursor,
   }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/* Internal Layout */
+
+/*
+ * The definitions in this section mirror private structures of LMDB 0.9.x
+ * (see mdb.c) on LP64 platforms, in the same spirit as `env::get_internal_map()`.
+ * They are only used by helpers that need to look at pages rather than at
+ * key/value pairs, such as map warm-up. Use at your own risk!
+ */
+
+namespace lmdb {
+  namespace internal {
+    static constexpr std::size_t page_header_size = 16;
+    static constexpr std::size_t invalid_pgno = (std::numeric_limits<std::size_t>::max)();
+
+    /* The largest leaf node kept on its page (LMDB's me_nodemax); nodes above it put their value on overflow pages. */
+    static constexpr std::size_t node_max(const std::size_t psize) noexcept {
+      return (((psize - page_header_size) / 2) & ~std::size_t(1)) - 2;
+    }
+
+    /* MDB_page.mp_flags */
+    static constexpr std::uint16_t p_branch   = 0x01;
+    static constexpr std::uint16_t p_leaf     = 0x02;
+    static constexpr std::uint16_t p_overflow = 0x04;
+    static constexpr std::uint16_t p_leaf2    = 0x20;
+
+    /* MDB_node.mn_flags */
+    static constexpr std::uint16_t f_bigdata = 0x01;
+    static constexpr std::uint16_t f_subdata = 0x02;
+    static constexpr std::uint16_t f_dupdata = 0x04;
+
+    /* MDB_db */
+    struct db {
+      std::uint32_t pad;
+      std::uint16_t flags;
+      std::uint16_t depth;
+      std::size_t branch_pages;
+      std::size_t leaf_pages;
+      std::size_t overflow_pages;
+      std::size_t entries;
+      std::size_t root;
+    };
+
+    /* A page (or run of overflow pages) visited by `tree::walk()`. */
+    struct page_ref {
+      std::size_t pgno;
+      std::size_t pages;
+      std::uint16_t flags;
+      unsigned int depth;
+      bool lo_edge;
+      bool hi_edge;
+    };
+
+    class tree;
+
+    static inline void check_lp64(const char* origin);
+    static inline std::string_view map(MDB_env* env);
+    static inline db cursor_db(MDB_cursor* cursor);
+    static inline std::size_t txn_id(MDB_txn* txn);
+    static inline bool read_only(MDB_txn* txn);
+
+    /* Where a cursor lies in its B+tree, see `cursor_position()`. */
+    struct cursor_pos {
+      double fraction;
+      const char* leaf;
+      std::size_t ki;
+    };
+
+    static inline cursor_pos cursor_position(MDB_cursor* cursor);
+#ifndef _WIN32
+    static inline int advise(std::string_view region, int advice) noexcept;
+    static inline void populate(const std::vector<std::string_view>& ranges, unsigned int threads) noexcept;
+    static inline std::vector<bool> resident(const tree& t, const std::vector<page_ref>& refs);
+#endif
+
+    template<typename T>
+    static inline T load(const char* const p) noexcept {
+      T result;
+      std::memcpy(&result, p, sizeof(T));
+      return result;
+    }
+
+    static inline std::uint16_t page_flags(const char* const p) noexcept {
+      return load<std::uint16_t>(p + 10);
+    }
+
+    static inline std::size_t page_numkeys(const char* const p) noexcept {
+      return (load<std::uint16_t>(p + 12) - page_header_size) >> 1;
+    }
+
+    static inline const char* page_node(const char* const p, const std::size_t i) noexcept {
+      return p + load<std::uint16_t>(p + page_header_size + 2 * i);
+    }
+
+    static inline std::uint16_t node_flags(const char* const n) noexcept {
+      return load<std::uint16_t>(n + 4);
+    }
+
+    static inline MDB_val node_key(const char* const n) noexcept {
+      return MDB_val{load<std::uint16_t>(n + 6), const_cast<char*>(n + 8)};
+    }
+
+    static inline const char* node_data(const char* const n) noexcept {
+      return n + 8 + load<std::uint16_t>(n + 6);
+    }
+
+    static inline std::size_t node_dsize(const char* const n) noexcept {
+      return load<std::uint16_t>(n) | (std::size_t(load<std::uint16_t>(n + 2)) << 16);
+    }
+
+    static inline std::size_t node_pgno(const char* const n) noexcept {
+      return node_dsize(n) | (std::size_t(node_flags(n)) << 32);
+    }
+  }
+}
+
+static inline void
+lmdb::internal::check_lp64(const char* const origin) {
+  if constexpr (sizeof(int) != 4 || sizeof(long) != 8 || sizeof(void*) != 8) error::raise(origin, 0);
+  (void)origin;
+}
+
+/**
+ * Returns LMDB's internal memory map of an open environment.
+ */
+static inline std::string_view
+lmdb::internal::map(MDB_env* const env) {
+  check_lp64("get_internal_map: only LP64 supported");
+
+  // This is a hack that depends on the internal layout of LMDB's MDB_env struct. Hopefully there
+  // will be a better way to get me_map at some point.
+
+  char *me_map = *(char**)(((char*)env) + 56);
+
+  MDB_envinfo arg;
+  lmdb::env_info(env, &arg);
+
+  return std::string_view(me_map, arg.me_mapsize);
+}
+
+/**
+ * Returns the `MDB_db` record a cursor operates on, as seen by its transaction.
+ */
+static inline lmdb::internal::db
+lmdb::internal::cursor_db(MDB_cursor* const cursor) {
+  check_lp64("cursor_db: only LP64 supported");
+
+  // MDB_cursor: mc_next, mc_backup, mc_xcursor, mc_txn, mc_dbi, then mc_db at offset 40.
+
+  return load<db>(*(const char**)(((const char*)cursor) + 40));
+}
+
+/**
+ * Returns the ID of a transaction: for a read-only transaction, that of the snapshot it reads.
+ */
+static inline std::size_t
+lmdb::internal::txn_id(MDB_txn* const txn) {
+#ifdef LMDBXX_TXN_ID
+  return lmdb::txn_id(txn);
+#else
+  check_lp64("txn_id: only LP64 supported");
+
+  // MDB_txn: mt_parent, mt_child, mt_next_pgno, then mt_txnid at offset 24.
+
+  return load<std::size_t>(((const char*)txn) + 24);
+#endif
+}
+
+/**
+ * Returns whether a transaction reads a committed snapshot, so that its pages are
+ * in the memory map. A write transaction's ID is one past the last committed one.
+ */
+static inline bool
+lmdb::internal::read_only(MDB_txn* const txn) {
+  MDB_envinfo info;
+  lmdb::env_info(lmdb::txn_env(txn), &info);
+  return txn_id(txn) <= info.me_last_txnid;
+}
+
+/**
+ * Returns the position of a positioned cursor as a fraction of its B+tree's key
+ * space, assuming uniform fanout below each page on the cursor's path.
+ */
+static inline lmdb::internal::cursor_pos
+lmdb::internal::cursor_position(MDB_cursor* const cursor) {
+  check_lp64("cursor_position: only LP64 supported");
+
+  // MDB_cursor: ..., mc_snum at offset 64, mc_top, mc_flags, mc_pg[32] at 72, mc_ki[32] at 328.
+
+  const char* const c = reinterpret_cast<const char*>(cursor);
+  const std::size_t snum = std::min<std::size_t>(load<std::uint16_t>(c + 64), 32);
+  cursor_pos result{0.0, nullptr, 0};
+  double scale = 1.0;
+  for (std::size_t i = 0; i < snum; i++) {
+    const char* const page = load<const char*>(c + 72 + sizeof(void*) * i);
+    const std::size_t ki = load<std::uint16_t>(c + 328 + 2 * i);
+    const std::size_t n = page_numkeys(page);
+    if (n == 0) break;
+    scale /= n;
+    result.fraction += ki * scale;
+    result.leaf = page;
+    result.ki = ki;
+  }
+  result.fraction = std::min(result.fraction, 1.0);
+  return result;
+}
+
+#ifndef _WIN32
+/**
+ * Applies `madvise()` to a region of the memory map, rounding its start down to a system page.
+ *
+ * @return 0 on success, otherwise an errno value
+ */
+static inline int
+lmdb::internal::advise(const std::string_view region,
+                       const int advice) noexcept {
+  static const std::uintptr_t os_page = static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE));
+  const auto addr = reinterpret_cast<std::uintptr_t>(region.data());
+  const auto start = addr & ~(os_page - 1);
+  if (::madvise(reinterpret_cast<void*>(start), region.size() + (addr - start), advice) != 0) return errno;
+  return 0;
+}
+
+/**
+ * Faults the given regions into the page cache, spreading them over worker threads.
+ * Uses `MADV_POPULATE_READ` where available, and `MADV_WILLNEED` otherwise. This is
+ * advisory, so failures are ignored.
+ *
+ * @param ranges
+ * @param threads number of worker threads, or 0 for one per CPU
+ */
+static inline void
+lmdb::internal::populate(const std::vector<std::string_view>& ranges,
+                         unsigned int threads) noexcept {
+  constexpr std::size_t chunk = 1 << 20;
+
+  std::vector<std::string_view> work;
+  for (const auto& r : ranges) {
+    for (std::size_t off = 0; off < r.size(); off += chunk) work.push_back(r.substr(off, chunk));
+  }
+
+  const auto run = [&work](const std::size_t first, const std::size_t stride) noexcept {
+    for (std::size_t i = first; i < work.size(); i += stride) {
+#ifdef MADV_POPULATE_READ
+      if (advise(work[i], MADV_POPULATE_READ) != EINVAL) continue;
+#endif
+      advise(work[i], MADV_WILLNEED);
+    }
+  };
+
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  if (threads > work.size()) threads = static_cast<unsigned int>(work.size());
+  if (threads <= 1) {
+    run(0, 1);
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  try {
+    for (unsigned int t = 1; t < threads; t++) workers.emplace_back(run, t, threads);
+  } catch (...) {}
+  run(0, workers.size() + 1 == threads ? threads : 1);
+  for (auto& w : workers) w.join();
+}
+#endif /* !_WIN32 */
+
+/**
+ * Level-order walker over the B+tree of one database, reading pages straight from the memory map.
+ *
+ * @note The transaction must be read-only: pages dirtied by a write transaction are not in the map.
+ */
+class lmdb::internal::tree {
+public:
+  MDB_txn* txn;
+  MDB_dbi dbi;
+  std::string_view map;
+  std::size_t psize;
+  std::size_t root;
+  unsigned int depth;
+
+  /**
+   * @param txn a read-only transaction handle
+   * @param dbi a database handle
+   * @throws lmdb::error on failure, or `MDB_BAD_TXN` for a write transaction
+   */
+  tree(MDB_txn* const txn,
+       const MDB_dbi dbi)
+    : txn{txn}, dbi{dbi} {
+    if (!read_only(txn)) error::raise("tree", MDB_BAD_TXN);
+    MDB_env* const env = lmdb::txn_env(txn);
+    map = internal::map(env);
+    MDB_stat st;
+    lmdb::env_stat(env, &st);
+    psize = st.ms_psize;
+    MDB_cursor* cursor{nullptr};
+    lmdb::cursor_open(txn, dbi, &cursor);
+    const db record = cursor_db(cursor);
+    lmdb::cursor_close(cursor);
+    root = record.root;
+    depth = record.depth;
+  }
+
+  /**
+   * Returns the address of a page (or run of pages) in the memory map.
+   *
+   * @throws lmdb::corrupted_error if the pages lie outside of the map
+   */
+  const char* page(const std::size_t pgno,
+                   const std::size_t count = 1) const {
+    if (pgno >= map.size() / psize || count > map.size() / psize - pgno) error::raise("tree::page", MDB_CORRUPTED);
+    return map.data() + pgno * psize;
+  }
+
+  /**
+   * Returns the region of the memory map covered by a set of pages, as coalesced runs.
+   */
+  std::vector<std::string_view> regions(std::vector<page_ref> refs) const {
+    std::sort(refs.begin(), refs.end(), [](const page_ref& a, const page_ref& b) { return a.pgno < b.pgno; });
+    std::vector<std::string_view> result;
+    std::size_t start = 0, end = 0;
+    for (const auto& r : refs) {
+      if (r.pgno > end || end == 0) {
+        if (end > start) result.emplace_back(page(start, end - start), (end - start) * psize);
+        start = r.pgno;
+      }
+      end = std::max(end, r.pgno + r.pages);
+    }
+    if (end > start) result.emplace_back(page(start, end - start), (end - start) * psize);
+    return result;
+  }
+
+  /**
+   * Visits the tree one level at a time. `before(level)` is called before any page of a level is
+   * read, and `after(level)` once their flags have been filled in. Overflow runs and the sub-trees
+   * of `MDB_DUPSORT` keys are reported on the level below the leaf that references them.
+   *
+   * @param lo if not null, skip subtrees entirely below this key
+   * @param hi if not null, skip subtrees entirely at or above this key
+   * @throws lmdb::error on failure
+   */
+  template<typename Before, typename After>
+  void walk(const std::string_view* const lo,
+            const std::string_view* const hi,
+            Before&& before,
+            After&& after) const {
+    if (root == invalid_pgno) return;
+
+    const MDB_val loV{lo ? lo->size() : 0, lo ? const_cast<char*>(lo->data()) : nullptr};
+    const MDB_val hiV{hi ? hi->size() : 0, hi ? const_cast<char*>(hi->data()) : nullptr};
+
+    // Index of the last branch node whose key is <= k (node 0 has an implicit lowest key).
+    const auto child_for = [this](const char* const p, const std::size_t n, const MDB_val& k) {
+      std::size_t a = 1, b = n;
+      while (a < b) {
+        const std::size_t m = (a + b) / 2;
+        const MDB_val key = node_key(page_node(p, m));
+        if (lmdb::dbi_cmp(txn, dbi, &key, &k) <= 0) a = m + 1; else b = m;
+      }
+      return a - 1;
+    };
+
+    std::vector<page_ref> level{page_ref{root, 1, 0, 1, true, true}};
+    while (!level.empty()) {
+      before(static_cast<const std::vector<page_ref>&>(level));
+
+      std::vector<page_ref> next;
+      for (auto& r : level) {
+        if (r.flags & p_overflow) continue;
+        const char* const p = page(r.pgno);
+        r.flags = page_flags(p);
+        const std::size_t n = page_numkeys(p);
+
+        if (r.flags & p_branch) {
+          if (n == 0) continue;
+          const std::size_t first = (lo && r.lo_edge) ? child_for(p, n, loV) : 0;
+          const std::size_t last = (hi && r.hi_edge) ? child_for(p, n, hiV) : n - 1;
+          for (std::size_t i = first; i <= last; i++) {
+            next.push_back(page_ref{node_pgno(page_node(p, i)), 1, 0, r.depth + 1, r.lo_edge && i == first, r.hi_edge && i == last});
+          }
+        } else if ((r.flags & p_leaf) && !(r.flags & p_leaf2)) {
+          for (std::size_t i = 0; i < n; i++) {
+            const char* const node = page_node(p, i);
+            const std::uint16_t nf = node_flags(node);
+            if (!(nf & f_bigdata) && (nf & (f_subdata | f_dupdata)) != (f_subdata | f_dupdata)) continue;
+            const MDB_val key = node_key(node);
+            if (lo && r.lo_edge && lmdb::dbi_cmp(txn, dbi, &key, &loV) < 0) continue;
+            if (hi && r.hi_edge && lmdb::dbi_cmp(txn, dbi, &key, &hiV) >= 0) continue;
+            if (nf & f_bigdata) {
+              const std::size_t pages = (page_header_size - 1 + node_dsize(node)) / psize + 1;
+              next.push_back(page_ref{load<std::size_t>(node_data(node)), pages, p_overflow, r.depth + 1, false, false});
+            } else {
+              const db sub = load<db>(node_data(node));
+              if (sub.root != invalid_pgno) next.push_back(page_ref{sub.root, 1, 0, r.depth + 1, false, false});
+            }
+          }
+        }
+      }
+
+      after(static_cast<const std::vector<page_ref>&>(level));
+      level.swap(next);
+    }
+  }
+};
+
+#ifndef _WIN32
+/**
+ * Reports, for each page (or overflow run), whether all of it is resident in the page cache.
+ *
+ * @throws lmdb::error on failure
+ */
+static inline std::vector<bool>
+lmdb::internal::resident(const tree& t,
+                         const std::vector<page_ref>& refs) {
+  static const std::uintptr_t os_page = static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE));
+
+  std::vector<std::size_t> order(refs.size());
+  for (std::size_t i = 0; i < order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&refs](std::size_t a, std::size_t b) { return refs[a].pgno < refs[b].pgno; });
+
+  std::vector<bool> result(refs.size());
+  std::vector<unsigned char> vec;
+  for (std::size_t i = 0; i < order.size();) {
+    const std::size_t start = refs[order[i]].pgno;
+    std::size_t end = start + refs[order[i]].pages;
+    std::size_t j = i + 1;
+    for (; j < order.size() && refs[order[j]].pgno <= end; j++) end = std::max(end, refs[order[j]].pgno + refs[order[j]].pages);
+
+    const auto addr = reinterpret_cast<std::uintptr_t>(t.page(start, end - start));
+    const auto base = addr & ~(os_page - 1);
+    const std::size_t len = (end - start) * t.psize + (addr - base);
+    vec.resize((len + os_page - 1) / os_page);
+#ifdef __APPLE__
+    if (::mincore(reinterpret_cast<void*>(base), len, reinterpret_cast<char*>(vec.data())) != 0) error::raise("mincore", errno);
+#else
+    if (::mincore(reinterpret_cast<void*>(base), len, vec.data()) != 0) error::raise("mincore", errno);
+#endif
+
+    for (; i < j; i++) {
+      const page_ref& r = refs[order[i]];
+      const std::size_t first = ((r.pgno - start) * t.psize + (addr - base)) / os_page;
+      const std::size_t last = ((r.pgno + r.pages - start) * t.psize + (addr - base) - 1) / os_page;
+      bool all = true;
+      for (std::size_t k = first; k <= last && all; k++) all = (vec[k] & 1);
+      result[order[i]] = all;
+    }
+  }
+  return result;
+}
+#endif /* !_WIN32 */
+
 ////////////////////////////////////////////////////////////////////////////////
 /* Resource Interface: Environment */
 
 namespace lmdb {
   class env;
+  struct reader_info;
+  struct freelist_stat;
+  struct dbi_space;
 }
 
 /**
@@ -1053,6 +1575,33 @@ public:
     return dead;
   }
 
+  /**
+   * Returns the entries of the reader lock table.
+   *
+   * @throws lmdb::error on failure
+   */
+  std::vector<reader_info> readers();
+
+  /**
+   * Analyzes the free-page database, reporting how much of the data file is
+   * free, how much of that can be reused now, and how fragmented it is.
+   * The cost is proportional to the size of the freelist.
+   *
+   * @param txn a transaction handle
+   * @throws lmdb::error on failure
+   */
+  freelist_stat freelist(MDB_txn* txn);
+
+  /**
+   * Collects page counts and size estimates for the main database and every
+   * named database, sorted by the space they occupy (largest first).
+   *
+   * @param txn a transaction handle
+   * @param samples number of entries read from the start of each database to estimate key/value sizes
+   * @throws lmdb::error on failure
+   */
+  std::vector<dbi_space> space(MDB_txn* txn, std::size_t samples = 1000);
+
   /**
    * Opens this environment.
    *
@@ -1116,92 +1665,416 @@ public:
    * @notice WARNING: This is a function to access LMDB's internal memory map, use at your own risk!
    */
   std::string_view get_internal_map() {
-    if constexpr (sizeof(int) != 4 || sizeof(long) != 8 || sizeof(void*) != 8) error::raise("get_internal_map: only LP64 supported", 0);
+    return internal::map(_handle);
+  }
+
+#ifndef _WIN32
+  /**
+   * Prefetches the used part of the memory map into the page cache.
+   *
+   * @param threads number of worker threads, or 0 for one per CPU
+   * @throws lmdb::error on failure
+   * @note This is built on `get_internal_map()`.
+   */
+  void prefetch(const unsigned int threads = 0) {
+    const std::string_view map = get_internal_map();
+    MDB_stat st;
+    MDB_envinfo info;
+    lmdb::env_stat(handle(), &st);
+    lmdb::env_info(handle(), &info);
+    const std::size_t used = std::min(map.size(), (info.me_last_pgno + 1) * std::size_t(st.ms_psize));
+    internal::populate({map.substr(0, used)}, threads);
+  }
 
-    // This is a hack that depends on the internal layout of LMDB's MDB_env struct. Hopefully there
-    // will be a better way to get me_map at some point.
+  /**
+   * Prefetches all pages of one database into the page cache: branch, leaf and
+   * overflow pages, and the sub-trees of `MDB_DUPSORT` keys.
+   *
+   * @param txn a read-only transaction handle
+   * @param dbi a database handle
+   * @param threads number of worker threads, or 0 for one per CPU
+   * @throws lmdb::error on failure
+   * @note This is built on `get_internal_map()`.
+   */
+  void prefetch(MDB_txn* const txn,
+                const MDB_dbi dbi,
+                const unsigned int threads = 0) {
+    prefetch_tree(txn, dbi, nullptr, nullptr, threads);
+  }
 
-    char *me_map = *(char**)(((char*)_handle) + 56);
+  /**
+   * Prefetches the pages of one database that hold keys in the range `[lo, hi)`.
+   *
+   * @param txn a read-only transaction handle
+   * @param dbi a database handle
+   * @param lo
+   * @param hi
+   * @param threads number of worker threads, or 0 for one per CPU
+   * @throws lmdb::error on failure
+   * @note This is built on `get_internal_map()`.
+   */
+  void prefetch(MDB_txn* const txn,
+                const MDB_dbi dbi,
+                const std::string_view lo,
+                const std::string_view hi,
+                const unsigned int threads = 0) {
+    prefetch_tree(txn, dbi, &lo, &hi, threads);
+  }
 
-    MDB_envinfo arg;
-    mdb_env_info(_handle, &arg);
+  /**
+   * Applies an access pattern hint (ie `MADV_RANDOM` or `MADV_SEQUENTIAL`) to the whole memory map.
+   *
+   * @param advice
+   * @throws lmdb::error on failure
+   * @see lmdb::access_hint
+   */
+  void advise(const int advice) {
+    const int rc = internal::advise(get_internal_map(), advice);
+    if (rc != 0) error::raise("madvise", rc);
+  }
 
-    return std::string_view(me_map, arg.me_mapsize);
+protected:
+  void prefetch_tree(MDB_txn* const txn,
+                     const MDB_dbi dbi,
+                     const std::string_view* const lo,
+                     const std::string_view* const hi,
+                     const unsigned int threads) {
+    const internal::tree tree{txn, dbi};
+    tree.walk(lo, hi,
+              [&](const std::vector<internal::page_ref>& level) { internal::populate(tree.regions(level), threads); },
+              [](const std::vector<internal::page_ref>&) {});
   }
+#endif /* !_WIN32 */
 };
 
-////////////////////////////////////////////////////////////////////////////////
-/* Resource Interface: Transactions */
+#ifndef _WIN32
 
 namespace lmdb {
-  class txn;
+  class access_hint;
 }
 
 /**
- * Resource class for `MDB_txn*` handles.
+ * Scoped access pattern hint for the memory map of an environment, for example
+ * `MADV_SEQUENTIAL` around a long cursor scan. The default hint is restored on
+ * destruction (`MADV_RANDOM` if the environment was opened with `MDB_NORDAHEAD`,
+ * `MADV_NORMAL` otherwise).
  *
- * @note Instances of this class are movable, but not copyable.
- * @see http://symas.com/mdb/doc/group__internal.html#structMDB__txn
+ * @note The hint applies to the whole process, so overlapping scopes with different hints will interfere.
+ * @note Instances of this class are not copyable.
  */
-class lmdb::txn {
+class lmdb::access_hint {
 protected:
-  MDB_txn* _handle{nullptr};
+  MDB_env* _env;
 
 public:
-  static constexpr unsigned int default_flags = 0;
-
   /**
-   * Creates a new LMDB transaction.
+   * Constructor.
    *
    * @param env the environment handle
-   * @param parent
-   * @param flags
+   * @param advice ie `MADV_RANDOM` or `MADV_SEQUENTIAL`
    * @throws lmdb::error on failure
    */
-  static txn begin(MDB_env* const env,
-                   MDB_txn* const parent = nullptr,
-                   const unsigned int flags = default_flags) {
-    MDB_txn* handle{nullptr};
-    lmdb::txn_begin(env, parent, flags, &handle);
-#ifdef LMDBXX_DEBUG
-    assert(handle != nullptr);
-#endif
-    return txn{handle};
+  access_hint(MDB_env* const env,
+              const int advice)
+    : _env{env} {
+    const int rc = internal::advise(internal::map(env), advice);
+    if (rc != 0) error::raise("madvise", rc);
   }
 
-  /**
-   * Constructor.
-   *
-   * @param handle a valid `MDB_txn*` handle
-   */
-  txn(MDB_txn* const handle) noexcept
-    : _handle{handle} {}
+  access_hint(const access_hint&) = delete;
+  access_hint& operator=(const access_hint&) = delete;
 
   /**
-   * Move constructor.
+   * Destructor.
    */
-  txn(txn&& other) noexcept {
-    std::swap(_handle, other._handle);
+  ~access_hint() noexcept {
+    try {
+      unsigned int flags{};
+      lmdb::env_get_flags(_env, &flags);
+      internal::advise(internal::map(_env), (flags & MDB_NORDAHEAD) ? MADV_RANDOM : MADV_NORMAL);
+    } catch (...) {}
   }
+};
+
+#endif /* !_WIN32 */
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Reader Table */
+
+namespace lmdb {
+  struct reader_report;
+  class reader_monitor;
+}
+
+/**
+ * An entry of the reader lock table, as reported by `mdb_reader_list()`.
+ */
+struct lmdb::reader_info {
+  /** Value of `txnid` for a slot that holds no snapshot (between transactions, or reset). */
+  static constexpr std::size_t idle = std::numeric_limits<std::size_t>::max();
+
+  int pid;
+  std::size_t thread;
+  std::size_t txnid;
 
   /**
-   * Move assignment operator.
+   * Parses the output of `mdb_reader_list()`.
    */
-  txn& operator=(txn&& other) noexcept {
-    if (this != &other) {
-      std::swap(_handle, other._handle);
+  static std::vector<reader_info> list(MDB_env* const env) {
+    std::string text;
+    lmdb::reader_list(env, [](const char* const msg, void* const ctx) -> int {
+      static_cast<std::string*>(ctx)->append(msg);
+      return 0;
+    }, &text);
+
+    std::vector<reader_info> result;
+    for (std::size_t pos = 0; pos < text.size();) {
+      std::size_t end = text.find('\n', pos);
+      if (end == std::string::npos) end = text.size();
+      const std::string line = text.substr(pos, end - pos);
+      pos = end + 1;
+
+      const char* p = line.c_str();
+      char* q;
+      const long pid = std::strtol(p, &q, 10);
+      if (q == p) continue; // header, or "(no active readers)"
+      reader_info info{static_cast<int>(pid), 0, idle};
+      p = q;
+      info.thread = static_cast<std::size_t>(std::strtoull(p, &q, 16));
+      p = q;
+      while (*p == ' ') p++;
+      if (*p != '-') info.txnid = static_cast<std::size_t>(std::strtoull(p, nullptr, 10));
+      result.push_back(info);
     }
-    return *this;
+    return result;
   }
+};
+
+inline std::vector<lmdb::reader_info>
+lmdb::env::readers() {
+  return reader_info::list(handle());
+}
+
+/**
+ * The result of one pass of `reader_monitor`.
+ */
+struct lmdb::reader_report {
+  /** ID of the most recent committed transaction. */
+  std::size_t last_txnid;
+  /** Number of stale slots cleared by `mdb_reader_check()`. */
+  int dead;
+  std::vector<reader_info> readers;
+  /** Snapshot of the oldest active reader, or `reader_info::idle` if there is none. */
+  std::size_t oldest_txnid;
 
   /**
-   * Destructor.
+   * Returns how many transactions the oldest active reader is behind. Pages freed
+   * by any of these transactions cannot be reused until that reader finishes.
    */
-  ~txn() noexcept {
-    if (_handle) {
-      try { abort(); } catch (...) {}
-      _handle = nullptr;
-    }
+  std::size_t lag() const noexcept {
+    return oldest_txnid == reader_info::idle || oldest_txnid > last_txnid ? 0 : last_txnid - oldest_txnid;
+  }
+};
+
+/**
+ * Background thread that periodically clears stale reader slots and watches
+ * the snapshot lag of the reader table. A single long-lived read transaction
+ * prevents reuse of every page freed after it began, so the map keeps growing
+ * until `MDB_MAP_FULL`.
+ *
+ * @note Instances of this class are not copyable.
+ */
+class lmdb::reader_monitor {
+public:
+  using callback = std::function<void(const reader_report&)>;
+
+  /**
+   * Runs one pass on the calling thread: calls `mdb_reader_check()`, reads the
+   * reader table, and computes the snapshot lag.
+   *
+   * @param env the environment handle
+   * @throws lmdb::error on failure
+   */
+  static reader_report check(MDB_env* const env) {
+    reader_report result{};
+    lmdb::reader_check(env, &result.dead);
+    MDB_envinfo info;
+    lmdb::env_info(env, &info);
+    result.last_txnid = info.me_last_txnid;
+    result.readers = reader_info::list(env);
+    result.oldest_txnid = reader_info::idle;
+    for (const auto& r : result.readers) result.oldest_txnid = std::min(result.oldest_txnid, r.txnid);
+    return result;
+  }
+
+  /**
+   * Constructor. Starts the monitoring thread.
+   *
+   * @param env the environment handle
+   * @param max_lag call `on_lag` when a pass finds `lag() >= max_lag`
+   * @param on_lag called from the monitoring thread, after the pass is recorded;
+   *        exceptions it throws are ignored
+   * @param interval time between passes
+   */
+  reader_monitor(MDB_env* const env,
+                 const std::size_t max_lag,
+                 callback on_lag,
+                 const std::chrono::milliseconds interval = std::chrono::seconds(1))
+    : _env{env}, _max_lag{max_lag}, _on_lag{std::move(on_lag)}, _interval{interval} {
+    _thread = std::thread([this] { run(); });
+  }
+
+  reader_monitor(const reader_monitor&) = delete;
+  reader_monitor& operator=(const reader_monitor&) = delete;
+
+  /**
+   * Destructor. Stops the monitoring thread.
+   */
+  ~reader_monitor() noexcept {
+    stop();
+  }
+
+  /**
+   * Returns the result of the most recent pass, for exporting as metrics.
+   */
+  reader_report last() const {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _last;
+  }
+
+  /**
+   * Returns the number of completed passes.
+   */
+  std::size_t passes() const {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _passes;
+  }
+
+  /**
+   * Stops the monitoring thread, waiting for a pass in progress to finish.
+   *
+   * @note this method is idempotent
+   */
+  void stop() noexcept {
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _stopping = true;
+    }
+    _wakeup.notify_all();
+    if (_thread.joinable()) _thread.join();
+  }
+
+protected:
+  MDB_env* _env;
+  std::size_t _max_lag;
+  callback _on_lag;
+  std::chrono::milliseconds _interval;
+  mutable std::mutex _mutex;
+  std::condition_variable _wakeup;
+  bool _stopping{false};
+  reader_report _last{};
+  std::size_t _passes{0};
+  std::thread _thread;
+
+  void run() {
+    std::unique_lock<std::mutex> lock{_mutex};
+    while (!_stopping) {
+      lock.unlock();
+      std::optional<reader_report> report;
+      try {
+        report = check(_env);
+      } catch (...) {
+        // A failed pass is skipped; the next one retries.
+      }
+      if (report) {
+        lock.lock();
+        _last = *report;
+        _passes++;
+        lock.unlock();
+        try {
+          if (report->lag() >= _max_lag && _on_lag) _on_lag(*report);
+        } catch (...) {
+          // The pass still counts; a throwing callback must not stop monitoring.
+        }
+      }
+      lock.lock();
+      _wakeup.wait_for(lock, _interval, [this] { return _stopping; });
+    }
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Transactions */
+
+namespace lmdb {
+  class txn;
+}
+
+/**
+ * Resource class for `MDB_txn*` handles.
+ *
+ * @note Instances of this class are movable, but not copyable.
+ * @see http://symas.com/mdb/doc/group__internal.html#structMDB__txn
+ */
+class lmdb::txn {
+protected:
+  MDB_txn* _handle{nullptr};
+
+public:
+  static constexpr unsigned int default_flags = 0;
+
+  /**
+   * Creates a new LMDB transaction.
+   *
+   * @param env the environment handle
+   * @param parent
+   * @param flags
+   * @throws lmdb::error on failure
+   */
+  static txn begin(MDB_env* const env,
+                   MDB_txn* const parent = nullptr,
+                   const unsigned int flags = default_flags) {
+    MDB_txn* handle{nullptr};
+    lmdb::txn_begin(env, parent, flags, &handle);
+#ifdef LMDBXX_DEBUG
+    assert(handle != nullptr);
+#endif
+    return txn{handle};
+  }
+
+  /**
+   * Constructor.
+   *
+   * @param handle a valid `MDB_txn*` handle
+   */
+  txn(MDB_txn* const handle) noexcept
+    : _handle{handle} {}
+
+  /**
+   * Move constructor.
+   */
+  txn(txn&& other) noexcept {
+    std::swap(_handle, other._handle);
+  }
+
+  /**
+   * Move assignment operator.
+   */
+  txn& operator=(txn&& other) noexcept {
+    if (this != &other) {
+      std::swap(_handle, other._handle);
+    }
+    return *this;
+  }
+
+  /**
+   * Destructor.
+   */
+  ~txn() noexcept {
+    if (_handle) {
+      try { abort(); } catch (...) {}
+      _handle = nullptr;
+    }
   }
 
   /**
@@ -1265,13 +2138,266 @@ public:
   }
 };
 
+////////////////////////////////////////////////////////////////////////////////
+/* Comparators */
+
+/**
+ * Comparator types for `dbi::set_compare<C>()` and `dbi::set_dupsort<C>()`.
+ *
+ * A comparator is a type with two static members:
+ *
+ *   - `int compare(const char* a, std::size_t an, const char* b, std::size_t bn) noexcept`
+ *     orders two byte strings;
+ *   - `std::size_t extent(const char* p, std::size_t n) noexcept` returns how many
+ *     leading bytes of `p` the comparator consumes, which lets comparators be
+ *     composed with `cmp::tuple`.
+ *
+ * Fixed-width comparators also define `width`. All loads go through `std::memcpy`,
+ * so keys need not be aligned, and integers are compared a whole word at a time.
+ */
+namespace lmdb::cmp {
+  namespace detail {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    static constexpr bool big_endian_host = true;
+#else
+    static constexpr bool big_endian_host = false;
+#endif
+
+    template<typename U>
+    static inline U bswap(U v) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+      if constexpr (sizeof(U) == 2) return __builtin_bswap16(v);
+      else if constexpr (sizeof(U) == 4) return __builtin_bswap32(v);
+      else if constexpr (sizeof(U) == 8) return __builtin_bswap64(v);
+      else
+#endif
+      {
+        U result = 0;
+        for (std::size_t i = 0; i < sizeof(U); i++) {
+          result = static_cast<U>((result << 8) | (v & 0xFF));
+          v = static_cast<U>(v >> 8);
+        }
+        return result;
+      }
+    }
+
+    /* Loads an unsigned integer stored in big-endian (Big = true) or little-endian byte order. */
+    template<typename U, bool Big>
+    static inline U load(const char* const p) noexcept {
+      U v;
+      std::memcpy(&v, p, sizeof(U));
+      if constexpr (sizeof(U) > 1 && Big != big_endian_host) v = bswap(v);
+      return v;
+    }
+
+    /* Stores an unsigned integer in big-endian (Big = true) or little-endian byte order. */
+    template<typename U, bool Big>
+    static inline void store(char* const p, U v) noexcept {
+      if constexpr (sizeof(U) > 1 && Big != big_endian_host) v = bswap(v);
+      std::memcpy(p, &v, sizeof(U));
+    }
+
+    template<typename T>
+    static inline int three_way(const T a, const T b) noexcept {
+      return (a > b) - (a < b);
+    }
+  }
+
+  /**
+   * Lexicographic byte order, shorter strings first on a tie. This is LMDB's default
+   * order, compared 8 bytes at a time.
+   */
+  struct lexical {
+    static int compare(const char* a, std::size_t an, const char* b, std::size_t bn) noexcept {
+      std::size_t n = std::min(an, bn);
+      for (; n >= 8; n -= 8, a += 8, b += 8) {
+        const auto x = detail::load<std::uint64_t, true>(a);
+        const auto y = detail::load<std::uint64_t, true>(b);
+        if (x != y) return detail::three_way(x, y);
+      }
+      for (; n; n--, a++, b++) {
+        if (*a != *b) return detail::three_way<unsigned char>(*a, *b);
+      }
+      return detail::three_way(an, bn);
+    }
+
+    static std::size_t extent(const char*, const std::size_t n) noexcept {
+      return n;
+    }
+  };
+
+  /**
+   * The order of `C`, reversed.
+   *
+   * @note This is a descending order, unlike `MDB_REVERSEKEY` which compares bytes from the end.
+   */
+  template<typename C = lexical>
+  struct reverse {
+    static int compare(const char* const a, const std::size_t an, const char* const b, const std::size_t bn) noexcept {
+      return C::compare(b, bn, a, an);
+    }
+
+    static std::size_t extent(const char* const p, const std::size_t n) noexcept {
+      return C::extent(p, n);
+    }
+  };
+
+  namespace detail {
+    template<typename T, bool Big>
+    struct integer {
+      static_assert(std::is_integral_v<T>, "integer comparators require an integral type");
+      using U = std::make_unsigned_t<T>;
+      static constexpr std::size_t width = sizeof(T);
+
+      static int compare(const char* const a, const std::size_t an, const char* const b, const std::size_t bn) noexcept {
+        if (an < width || bn < width) return lexical::compare(a, an, b, bn); // malformed, but keep a total order
+        U x = load<U, Big>(a), y = load<U, Big>(b);
+        if constexpr (std::is_signed_v<T>) {
+          constexpr U sign = U(1) << (8 * width - 1);
+          x ^= sign;
+          y ^= sign;
+        }
+        if (x != y) return three_way(x, y);
+        return three_way(an, bn);
+      }
+
+      static std::size_t extent(const char*, const std::size_t n) noexcept {
+        return std::min(n, width);
+      }
+    };
+  }
+
+  /**
+   * Integers of type `T` stored in big-endian byte order.
+   */
+  template<typename T>
+  struct big_endian : detail::integer<T, true> {};
+
+  /**
+   * Integers of type `T` stored in little-endian byte order. Unlike `MDB_INTEGERKEY`,
+   * this supports signed types and doesn't depend on the byte order of the host.
+   */
+  template<typename T>
+  struct little_endian : detail::integer<T, false> {};
+
+  /**
+   * Strings preceded by their length, stored as a big-endian `L`, ordered by `C`
+   * on their contents. Useful as a non-final component of a `cmp::tuple`.
+   */
+  template<typename C = lexical, typename L = std::uint8_t>
+  struct length_prefixed {
+    static_assert(std::is_unsigned_v<L>, "length prefix must be an unsigned type");
+
+    static int compare(const char* const a, const std::size_t an, const char* const b, const std::size_t bn) noexcept {
+      if (an < sizeof(L) || bn < sizeof(L)) return lexical::compare(a, an, b, bn);
+      return C::compare(a + sizeof(L), extent(a, an) - sizeof(L), b + sizeof(L), extent(b, bn) - sizeof(L));
+    }
+
+    static std::size_t extent(const char* const p, const std::size_t n) noexcept {
+      if (n < sizeof(L)) return n;
+      return sizeof(L) + std::min<std::size_t>(detail::load<L, true>(p), n - sizeof(L));
+    }
+  };
+
+  /**
+   * Keys made of consecutive components, compared component by component.
+   * Each component but the last must know its own extent (fixed-width integers,
+   * `length_prefixed`), and the last one receives all remaining bytes.
+   */
+  template<typename... Cs>
+  struct tuple {
+    static_assert(sizeof...(Cs) > 0, "tuple comparator requires at least one component");
+
+    static int compare(const char* const a, const std::size_t an, const char* const b, const std::size_t bn) noexcept {
+      return compare_from<Cs...>(a, an, b, bn);
+    }
+
+    static std::size_t extent(const char* const p, const std::size_t n) noexcept {
+      return extent_from<Cs...>(p, n);
+    }
+
+  private:
+    template<typename C, typename... Rest>
+    static int compare_from(const char* const a, const std::size_t an, const char* const b, const std::size_t bn) noexcept {
+      if constexpr (sizeof...(Rest) == 0) {
+        return C::compare(a, an, b, bn);
+      } else {
+        const std::size_t ax = C::extent(a, an), bx = C::extent(b, bn);
+        if (const int rc = C::compare(a, ax, b, bx)) return rc;
+        return compare_from<Rest...>(a + ax, an - ax, b + bx, bn - bx);
+      }
+    }
+
+    template<typename C, typename... Rest>
+    static std::size_t extent_from(const char* const p, const std::size_t n) noexcept {
+      const std::size_t x = C::extent(p, n);
+      if constexpr (sizeof...(Rest) == 0) return x;
+      else return x + extent_from<Rest...>(p + x, n - x);
+    }
+  };
+
+  /**
+   * An `MDB_cmp_func` that orders keys (or duplicate values) with comparator `C`.
+   */
+  template<typename C>
+  static int func(const MDB_val* const a, const MDB_val* const b) {
+    return C::compare(static_cast<const char*>(a->mv_data), a->mv_size,
+                      static_cast<const char*>(b->mv_data), b->mv_size);
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /* Resource Interface: Databases */
 
 namespace lmdb {
   class dbi;
+  struct residency_stat;
+  struct range_estimate;
+  template<typename T, typename Enable = void> struct encoder;
 }
 
+/**
+ * An estimated number of entries in a key range, as returned by `dbi::estimate_bounds()`.
+ */
+struct lmdb::range_estimate {
+  /** The estimate, which lies in `[min, max]`. */
+  std::size_t count;
+  /** The range holds at least this many entries. */
+  std::size_t min;
+  /** The range holds at most this many entries. */
+  std::size_t max;
+};
+
+/**
+ * Page-cache residency of one database, as reported by `dbi::residency()`.
+ */
+struct lmdb::residency_stat {
+  /**
+   * Leaf pages of one slice of the key space, in key order.
+   */
+  struct bucket {
+    std::string first_key;
+    std::size_t pages;
+    std::size_t resident;
+  };
+
+  std::size_t psize;
+  std::size_t branch_pages;
+  std::size_t branch_resident;
+  std::size_t leaf_pages;
+  std::size_t leaf_resident;
+  std::size_t overflow_pages;
+  std::size_t overflow_resident;
+  std::vector<bucket> histogram;
+
+  /**
+   * Returns the number of bytes of this database currently in the page cache.
+   */
+  std::size_t resident_bytes() const noexcept {
+    return (branch_resident + leaf_resident + overflow_resident) * psize;
+  }
+};
+
 /**
  * Resource class for `MDB_dbi` handles.
  *
@@ -1319,6 +2445,63 @@ public:
     return dbi{handle};
   }
 
+  /**
+   * Returns the names of all named databases, by iterating the main database.
+   *
+   * @param txn a transaction handle
+   * @throws lmdb::error on failure
+   * @note Each named database is opened (without `MDB_CREATE`) to tell it apart from plain keys
+   *       stored in the main database, so the environment needs enough `set_max_dbs()` slots.
+   */
+  static std::vector<std::string> names(MDB_txn* txn);
+
+  /**
+   * Estimates the number of entries with keys in `[lo, hi)`, from where the two
+   * bounds fall in the B+tree. No leaf pages are scanned: the cost is two tree
+   * descents. See `estimate_bounds()` for the error.
+   *
+   * @param txn a transaction handle
+   * @param lo inclusive lower bound, or empty for the first key
+   * @param hi exclusive upper bound, or empty for past the last key
+   * @throws lmdb::error on failure
+   * @note This depends on the internal layout of LMDB's cursors, and is only supported on LP64 platforms.
+   */
+  std::size_t estimate(MDB_txn* txn, std::string_view lo = {}, std::string_view hi = {}) const;
+
+  /**
+   * Like `estimate()`, but also returns bounds that always hold. The keys of the
+   * two leaf pages the bounds fall in are counted exactly, so `min` is the number
+   * of them inside the range, and `max` is `ms_entries` less the number outside it.
+   * Only the pages between the two leaves are estimated, from the fanout of the
+   * pages on the two paths, and the count is clamped to `[min, max]`. When both
+   * bounds fall in the same leaf of a database without `MDB_DUPSORT`, it is exact.
+   *
+   * @param txn a transaction handle
+   * @param lo inclusive lower bound, or empty for the first key
+   * @param hi exclusive upper bound, or empty for past the last key
+   * @throws lmdb::error on failure
+   * @note In an `MDB_DUPSORT` database, each key of a boundary leaf is counted as at
+   *       least one entry. Without cursor internals (ie non-LP64), the bounds are `[0, ms_entries]`.
+   */
+  range_estimate estimate_bounds(MDB_txn* txn, std::string_view lo = {}, std::string_view hi = {}) const;
+
+  /**
+   * Returns up to `parts - 1` keys that split this database into `parts` ranges
+   * of roughly equal size. In a read-only transaction, the keys are taken from
+   * the highest level of the B+tree that has at least `parts` nodes, so only that
+   * level and the ones above it are read.
+   *
+   * A write transaction's dirty pages aren't in the memory map, so there the keys
+   * are found by stepping through the database with a cursor instead, which takes
+   * time linear in its size.
+   *
+   * @param txn a transaction handle, preferably read-only
+   * @param parts number of ranges
+   * @throws lmdb::error on failure
+   * @note This is built on `env::get_internal_map()`.
+   */
+  std::vector<std::string> split_points(MDB_txn* txn, std::size_t parts) const;
+
   /**
    * Constructor.
    *
@@ -1392,6 +2575,59 @@ public:
     return stat(txn).ms_entries;
   }
 
+#ifndef _WIN32
+  /**
+   * Reports how much of this database is resident in the page cache, by walking its
+   * B+tree out of the memory map and querying each page with `mincore()`. Pages are
+   * checked before they are read, so the walk itself doesn't skew the result (apart
+   * from branch pages, which are needed to find the rest).
+   *
+   * @param txn a read-only transaction handle
+   * @param buckets number of key-ordered slices of leaf pages to report in `histogram`
+   * @throws lmdb::error on failure
+   * @note This is built on `env::get_internal_map()`.
+   */
+  residency_stat residency(MDB_txn* const txn,
+                           const unsigned int buckets = 16) const {
+    const internal::tree tree{txn, handle()};
+    residency_stat result{};
+    result.psize = tree.psize;
+
+    std::vector<bool> resident;
+    tree.walk(nullptr, nullptr,
+      [&](const std::vector<internal::page_ref>& level) {
+        resident = internal::resident(tree, level);
+      },
+      [&](const std::vector<internal::page_ref>& level) {
+        for (std::size_t i = 0; i < level.size(); i++) {
+          const internal::page_ref& r = level[i];
+          const std::size_t hit = resident[i] ? r.pages : 0;
+          if (r.flags & internal::p_overflow) { result.overflow_pages += r.pages; result.overflow_resident += hit; }
+          else if (r.flags & internal::p_branch) { result.branch_pages++; result.branch_resident += hit; }
+          else { result.leaf_pages++; result.leaf_resident += hit; }
+        }
+
+        if (level.empty() || level[0].depth != tree.depth || !buckets) return;
+        const std::size_t per = (level.size() + buckets - 1) / buckets;
+        for (std::size_t i = 0; i < level.size(); i++) {
+          if (i % per == 0) {
+            const char* const p = tree.page(level[i].pgno);
+            std::string first;
+            if (internal::page_numkeys(p)) {
+              const MDB_val key = internal::node_key(internal::page_node(p, 0));
+              first.assign(static_cast<const char*>(key.mv_data), key.mv_size);
+            }
+            result.histogram.push_back(residency_stat::bucket{std::move(first), 0, 0});
+          }
+          result.histogram.back().pages++;
+          result.histogram.back().resident += resident[i];
+        }
+      });
+
+    return result;
+  }
+#endif
+
   /**
    * @param txn a transaction handle
    * @param del
@@ -1416,28 +2652,66 @@ public:
   }
 
   /**
-   * Retrieves a key/value pair from this database.
+   * Sets the key order of this database to that of comparator `C`, ie
+   * `mydb.set_compare<lmdb::cmp::big_endian<int64_t>>(txn)`.
    *
    * @param txn a transaction handle
-   * @param key
-   * @param data
    * @throws lmdb::error on failure
    */
-
-  bool get(MDB_txn* const txn,
-           const std::string_view key,
-           std::string_view& data) {
-    const MDB_val keyV{key.size(), const_cast<char*>(key.data())};
-    MDB_val dataV{data.size(), const_cast<char*>(data.data())};
-    bool ret = lmdb::dbi_get(txn, handle(), &keyV, &dataV);
-    if (ret) {
-        data = std::string_view(static_cast<char*>(dataV.mv_data), dataV.mv_size);
-    }
-    return ret;
+  template<typename C>
+  dbi& set_compare(MDB_txn* const txn) {
+    lmdb::dbi_set_compare(txn, handle(), &cmp::func<C>);
+    return *this;
   }
 
   /**
-   * Stores a key/value pair into this database.
+   * Sets a custom duplicate data comparison function for this `MDB_DUPSORT` database.
+   *
+   * @param txn a transaction handle
+   * @param cmp the comparison function
+   * @throws lmdb::error on failure
+   */
+  dbi& set_dupsort(MDB_txn* const txn,
+                   MDB_cmp_func* const cmp = nullptr) {
+    lmdb::dbi_set_dupsort(txn, handle(), cmp);
+    return *this;
+  }
+
+  /**
+   * Sets the duplicate data order of this `MDB_DUPSORT` database to that of comparator `C`.
+   *
+   * @param txn a transaction handle
+   * @throws lmdb::error on failure
+   */
+  template<typename C>
+  dbi& set_dupsort(MDB_txn* const txn) {
+    lmdb::dbi_set_dupsort(txn, handle(), &cmp::func<C>);
+    return *this;
+  }
+
+  /**
+   * Retrieves a key/value pair from this database.
+   *
+   * @param txn a transaction handle
+   * @param key
+   * @param data
+   * @throws lmdb::error on failure
+   */
+
+  bool get(MDB_txn* const txn,
+           const std::string_view key,
+           std::string_view& data) {
+    const MDB_val keyV{key.size(), const_cast<char*>(key.data())};
+    MDB_val dataV{data.size(), const_cast<char*>(data.data())};
+    bool ret = lmdb::dbi_get(txn, handle(), &keyV, &dataV);
+    if (ret) {
+        data = std::string_view(static_cast<char*>(dataV.mv_data), dataV.mv_size);
+    }
+    return ret;
+  }
+
+  /**
+   * Stores a key/value pair into this database.
    *
    * @param txn a transaction handle
    * @param key
@@ -1454,6 +2728,154 @@ public:
     return lmdb::dbi_put(txn, handle(), &keyV, &dataV, flags);
   }
 
+  /**
+   * Reserves space for a value in this database (`MDB_RESERVE`), so that it
+   * can be written in place instead of copied from a buffer.
+   *
+   * @param txn a transaction handle
+   * @param key
+   * @param size the size of the value
+   * @param flags
+   * @returns a pointer to the reserved space, which must be filled before the next
+   *          write in this transaction, or nullptr if `MDB_NOOVERWRITE` was given
+   *          and the key exists
+   * @throws lmdb::error on failure
+   * @note Not supported by `MDB_DUPSORT` databases.
+   */
+  char* reserve(MDB_txn* const txn,
+                const std::string_view key,
+                const std::size_t size,
+                const unsigned int flags = default_put_flags) {
+    const MDB_val keyV{key.size(), const_cast<char*>(key.data())};
+    MDB_val dataV{size, nullptr};
+    if (!lmdb::dbi_put(txn, handle(), &keyV, &dataV, flags | MDB_RESERVE)) return nullptr;
+    return static_cast<char*>(dataV.mv_data);
+  }
+
+  /**
+   * Stores a value by reserving its space and calling `fill(char* data)` to write it in place.
+   *
+   * @throws lmdb::error on failure
+   */
+  template<typename F>
+  bool put_reserve(MDB_txn* const txn,
+                   const std::string_view key,
+                   const std::size_t size,
+                   F&& fill,
+                   const unsigned int flags = default_put_flags) {
+    char* const data = reserve(txn, key, size, flags);
+    if (!data) return false;
+    fill(data);
+    return true;
+  }
+
+  /**
+   * Stores a value serialized in place by `lmdb::encoder<T>`.
+   *
+   * @throws lmdb::error on failure
+   */
+  template<typename T>
+  bool put_encoded(MDB_txn* const txn,
+                   const std::string_view key,
+                   const T& value,
+                   const unsigned int flags = default_put_flags) {
+    return put_reserve(txn, key, encoder<T>::size(value), [&](char* const data) { encoder<T>::encode(value, data); }, flags);
+  }
+
+  /**
+   * Modifies a fixed-size value in place, with a single tree descent. `fn(T&)` is
+   * called on an aligned copy of the value, and the result is written into space
+   * reserved with `MDB_CURRENT | MDB_RESERVE` (under `MDB_WRITEMAP`, in the map itself).
+   *
+   * @param txn a write transaction handle
+   * @param key
+   * @param fn called as `fn(T& value)`
+   * @returns false if the key doesn't exist
+   * @throws lmdb::error on failure, or `MDB_BAD_VALSIZE` if the value isn't `sizeof(T)` bytes
+   * @note Not supported by `MDB_DUPSORT` databases.
+   */
+  template<typename T, typename F>
+  bool update(MDB_txn* txn, std::string_view key, F&& fn);
+
+  /**
+   * Stores a batch of key/value pairs in key order, so that a batch of random
+   * keys dirties neighbouring pages together instead of pages all over the tree.
+   * The batch is radix-sorted on its key bytes, and applied with one cursor moving
+   * forward, using `MDB_APPEND` for keys past the largest key in the database.
+   *
+   * @param txn a write transaction handle
+   * @param batch the pairs, in arrival order. Of pairs with equal keys, the last
+   *        one wins, except in `MDB_DUPSORT` databases where all are stored.
+   * @param flags put flags, ie `MDB_NOOVERWRITE`
+   * @returns the number of pairs stored, not counting key/value pairs that a
+   *          `MDB_DUPSORT` database already held
+   * @throws lmdb::error on failure
+   * @note `MDB_REVERSEKEY` and `MDB_INTEGERKEY` batches are sorted with `mdb_cmp()`
+   *       instead. With a custom comparator, the batch is still stored correctly, but
+   *       in byte-wise order.
+   */
+  std::size_t put_batch(MDB_txn* txn,
+                        const std::vector<std::pair<std::string_view, std::string_view>>& batch,
+                        unsigned int flags = default_put_flags);
+
+  /**
+   * Removes the keys in `[lo, hi)` with a single cursor, deleting all the values
+   * of a key at once in `MDB_DUPSORT` databases. When the range covers the whole
+   * database, it is emptied with `drop()` instead.
+   *
+   * @param txn a write transaction handle
+   * @param lo the first key to remove, or empty to start at the first key
+   * @param hi the key to stop at, or empty to continue to the end
+   * @param limit stop after removing this many entries (or a few more, when the last
+   *        key removed has duplicates)
+   * @returns the number of entries removed
+   * @throws lmdb::error on failure
+   */
+  std::size_t delete_range(MDB_txn* txn, std::string_view lo = {}, std::string_view hi = {}, std::size_t limit = SIZE_MAX);
+
+  /**
+   * Removes the keys in `[lo, hi)` in a series of write transactions, each
+   * removing about `batch` entries, so that large deletions neither hold the
+   * write lock for long nor grow a single transaction without bound.
+   *
+   * @param env the environment handle
+   * @param lo the first key to remove, or empty to start at the first key
+   * @param hi the key to stop at, or empty to continue to the end
+   * @param batch entries to remove per transaction
+   * @returns the number of entries removed
+   * @throws lmdb::error on failure. Batches already committed stay committed.
+   */
+  std::size_t delete_range(MDB_env* env, std::string_view lo, std::string_view hi, std::size_t batch);
+
+  /**
+   * Removes the keys that start with `prefix`.
+   *
+   * @returns the number of entries removed
+   * @throws lmdb::error on failure
+   * @note Assumes the default, byte-wise key order.
+   */
+  std::size_t delete_prefix(MDB_txn* txn, std::string_view prefix, std::size_t limit = SIZE_MAX);
+
+  /**
+   * Removes the keys that start with `prefix`, in transactions of about `batch` entries.
+   *
+   * @returns the number of entries removed
+   * @throws lmdb::error on failure
+   * @note Assumes the default, byte-wise key order.
+   */
+  std::size_t delete_prefix(MDB_env* env, std::string_view prefix, std::size_t batch);
+
+  /**
+   * Returns the first key after all the keys that start with `prefix`, in byte-wise
+   * order, or an empty string if there is none.
+   */
+  static std::string prefix_end(std::string_view prefix) {
+    std::string result{prefix};
+    while (!result.empty() && static_cast<unsigned char>(result.back()) == 0xFF) result.pop_back();
+    if (!result.empty()) result.back() = static_cast<char>(static_cast<unsigned char>(result.back()) + 1);
+    return result;
+  }
+
   /**
    * Removes a key from this database.
    *
@@ -1661,6 +3083,54 @@ public:
     return lmdb::cursor_put(handle(), &keyV, &valV, flags);
   }
 
+  /**
+   * Reserves space for a value (`MDB_RESERVE`). The cursor is positioned at the new item.
+   *
+   * @param key
+   * @param size the size of the value
+   * @param flags
+   * @returns a pointer to the reserved space, which must be filled before the next
+   *          write in this transaction, or nullptr if the key exists and
+   *          `MDB_NOOVERWRITE` was given
+   * @throws lmdb::error on failure
+   */
+  char* reserve(const std::string_view &key,
+                const std::size_t size,
+                const unsigned int flags = 0) {
+    MDB_val keyV{key.size(), const_cast<char*>(key.data())};
+    MDB_val valV{size, nullptr};
+    if (!lmdb::cursor_put(handle(), &keyV, &valV, flags | MDB_RESERVE)) return nullptr;
+    return static_cast<char*>(valV.mv_data);
+  }
+
+  /**
+   * Stores a value by reserving its space and calling `fill(char* data)` to write it in place.
+   *
+   * @throws lmdb::error on failure
+   */
+  template<typename F>
+  bool put_reserve(const std::string_view &key,
+                   const std::size_t size,
+                   F&& fill,
+                   const unsigned int flags = 0) {
+    char* const data = reserve(key, size, flags);
+    if (!data) return false;
+    fill(data);
+    return true;
+  }
+
+  /**
+   * Stores a value serialized in place by `lmdb::encoder<T>`.
+   *
+   * @throws lmdb::error on failure
+   */
+  template<typename T>
+  bool put_encoded(const std::string_view &key,
+                   const T& value,
+                   const unsigned int flags = 0) {
+    return put_reserve(key, encoder<T>::size(value), [&](char* const data) { encoder<T>::encode(value, data); }, flags);
+  }
+
   /**
    * Delete current key/data pair.
    *
@@ -1681,6 +3151,291 @@ public:
   }
 };
 
+inline std::vector<std::string>
+lmdb::dbi::names(MDB_txn* const txn) {
+  std::vector<std::string> result;
+  auto cursor = lmdb::cursor::open(txn, lmdb::dbi::open(txn));
+  std::string_view key;
+  for (bool found = cursor.get(key, MDB_FIRST); found; found = cursor.get(key, MDB_NEXT_NODUP)) {
+    if (key.find('\0') != std::string_view::npos) continue;
+    std::string name(key);
+    MDB_dbi handle{};
+    const int rc = ::mdb_dbi_open(txn, name.c_str(), 0, &handle);
+    if (rc == MDB_INCOMPATIBLE) continue;
+    if (rc != MDB_SUCCESS) error::raise("mdb_dbi_open", rc);
+    result.push_back(std::move(name));
+  }
+  return result;
+}
+
+inline std::size_t
+lmdb::dbi::estimate(MDB_txn* const txn,
+                    const std::string_view lo,
+                    const std::string_view hi) const {
+  return estimate_bounds(txn, lo, hi).count;
+}
+
+inline lmdb::range_estimate
+lmdb::dbi::estimate_bounds(MDB_txn* const txn,
+                           const std::string_view lo,
+                           const std::string_view hi) const {
+  const std::size_t entries = stat(txn).ms_entries;
+  const MDB_val loV{lo.size(), const_cast<char*>(lo.data())};
+  const MDB_val hiV{hi.size(), const_cast<char*>(hi.data())};
+  if (entries == 0 || (!lo.empty() && !hi.empty() && lmdb::dbi_cmp(txn, handle(), &loV, &hiV) >= 0)) return range_estimate{0, 0, 0};
+
+  // Where the first key not less than `key` is, or past the last key for an empty upper bound
+  const auto position = [&](const std::string_view key, const bool upper) {
+    auto c = lmdb::cursor::open(txn, handle());
+    std::string_view k{key};
+    if (key.empty() ? !upper && c.get(k, MDB_FIRST) : c.get(k, MDB_SET_RANGE)) return internal::cursor_position(c);
+    if (!c.get(k, MDB_LAST)) return internal::cursor_pos{1.0, nullptr, 0};
+    internal::cursor_pos result = internal::cursor_position(c);
+    result.fraction = 1.0;
+    result.ki++;
+    return result;
+  };
+  const internal::cursor_pos from = position(lo, false), to = position(hi, true);
+
+  const bool dupsort = flags(txn) & MDB_DUPSORT;
+  range_estimate result{0, 0, entries};
+  if (from.leaf && to.leaf) {
+    const std::size_t from_keys = internal::page_numkeys(from.leaf);
+    const std::size_t to_keys = internal::page_numkeys(to.leaf);
+    if (from.leaf == to.leaf) {
+      const std::size_t keys = to.ki > from.ki ? to.ki - from.ki : 0;
+      if (!dupsort) return range_estimate{keys, keys, keys};
+      result.min = keys;
+      result.max = entries - (from_keys - keys);
+    } else {
+      result.min = (from_keys - from.ki) + to.ki;
+      result.max = entries - from.ki - (to_keys - to.ki);
+    }
+  }
+  const double count = (to.fraction - from.fraction) * entries;
+  result.count = count > 0 ? static_cast<std::size_t>(count + 0.5) : 0;
+  result.count = std::clamp(result.count, result.min, result.max);
+  return result;
+}
+
+inline std::vector<std::string>
+lmdb::dbi::split_points(MDB_txn* const txn,
+                        const std::size_t parts) const {
+  std::vector<std::string> result;
+  if (parts < 2) return result;
+
+  if (!internal::read_only(txn)) {
+    const std::size_t entries = size(txn);
+    auto c = lmdb::cursor::open(txn, handle());
+    std::string_view key, val;
+    std::size_t i = 0, j = 1;
+    for (bool found = c.get(key, val, MDB_FIRST); found && j < parts; found = c.get(key, val, MDB_NEXT), i++) {
+      for (; j < parts && i >= j * entries / parts; j++) {
+        if (i > 0 && (result.empty() || result.back() != key)) result.emplace_back(key);
+      }
+    }
+    return result;
+  }
+
+  const internal::tree tree{txn, handle()};
+  if (tree.root == internal::invalid_pgno) return result;
+
+  // Each entry is a page, and the lowest key of its subtree (empty for the leftmost).
+  std::vector<std::pair<std::size_t, std::string_view>> level{{tree.root, {}}};
+  for (;;) {
+    std::vector<std::string_view> keys;
+    std::vector<std::pair<std::size_t, std::string_view>> next;
+    bool leaf = false;
+    for (const auto& [pgno, low] : level) {
+      const char* const p = tree.page(pgno);
+      const std::size_t n = internal::page_numkeys(p);
+      leaf = internal::page_flags(p) & internal::p_leaf;
+      for (std::size_t i = 0; i < n; i++) {
+        const char* const node = internal::page_node(p, i);
+        const MDB_val k = internal::node_key(node);
+        const std::string_view key = (i == 0 && !leaf) ? low : std::string_view(static_cast<const char*>(k.mv_data), k.mv_size);
+        keys.push_back(key);
+        if (!leaf) next.emplace_back(internal::node_pgno(node), key);
+      }
+    }
+
+    if (keys.empty()) return result;
+    if (leaf || keys.size() >= parts) {
+      for (std::size_t j = 1; j < parts; j++) {
+        const std::string_view key = keys[j * keys.size() / parts];
+        if (!key.empty() && (result.empty() || result.back() != key)) result.emplace_back(key);
+      }
+      return result;
+    }
+    level.swap(next);
+  }
+}
+
+template<typename T, typename F>
+inline bool
+lmdb::dbi::update(MDB_txn* const txn,
+                  const std::string_view key,
+                  F&& fn) {
+  static_assert(std::is_trivially_copyable_v<T>, "dbi::update() requires a trivially copyable type");
+  auto cursor = lmdb::cursor::open(txn, handle());
+  std::string_view k{key}, v;
+  if (!cursor.get(k, v, MDB_SET_KEY)) return false;
+  if (v.size() != sizeof(T)) error::raise("dbi::update", MDB_BAD_VALSIZE);
+  // Copy the old value first: when it lives on clean overflow pages, the reserve
+  // frees them and returns new, uninitialized ones
+  T value;
+  std::memcpy(&value, v.data(), sizeof(T));
+  fn(value);
+  char* const data = cursor.reserve(k, sizeof(T), MDB_CURRENT);
+  std::memcpy(data, &value, sizeof(T));
+  return true;
+}
+
+namespace lmdb::internal {
+  /* Key bytes radix-sorted before falling back to a comparison sort. Each level of
+     recursion takes a few KB of stack, so long shared prefixes mustn't recurse per byte. */
+  static constexpr std::size_t radix_max_depth = 16;
+
+  /* Stable MSD radix sort of `idx[0, n)` by the bytes of `key(idx[i])` from `depth` on, with `tmp` as scratch space. */
+  template<typename K>
+  static void radix_sort(std::size_t* const idx,
+                         std::size_t* const tmp,
+                         const std::size_t n,
+                         const K& key,
+                         const std::size_t depth) {
+    if (n < 32 || depth >= radix_max_depth) {
+      std::stable_sort(idx, idx + n, [&](const std::size_t a, const std::size_t b) { return key(a).substr(depth) < key(b).substr(depth); });
+      return;
+    }
+    // Bucket 0 holds the keys that end at `depth`, bucket b + 1 those with byte b there
+    const auto bucket = [&](const std::size_t i) {
+      const std::string_view k = key(i);
+      return k.size() > depth ? std::size_t(static_cast<unsigned char>(k[depth])) + 1 : 0;
+    };
+    std::size_t offsets[258] = {};
+    for (std::size_t i = 0; i < n; i++) offsets[bucket(idx[i]) + 1]++;
+    for (std::size_t b = 1; b < 258; b++) offsets[b] += offsets[b - 1];
+    std::size_t next[257];
+    std::copy(offsets, offsets + 257, next);
+    for (std::size_t i = 0; i < n; i++) tmp[next[bucket(idx[i])]++] = idx[i];
+    std::copy(tmp, tmp + n, idx);
+    // Keys that end at `depth` are equal, and already in arrival order
+    for (std::size_t b = 1; b < 257; b++) {
+      const std::size_t size = offsets[b + 1] - offsets[b];
+      if (size > 1) radix_sort(idx + offsets[b], tmp + offsets[b], size, key, depth + 1);
+    }
+  }
+}
+
+inline std::size_t
+lmdb::dbi::put_batch(MDB_txn* const txn,
+                     const std::vector<std::pair<std::string_view, std::string_view>>& batch,
+                     const unsigned int put_flags) {
+  const unsigned int db_flags = flags(txn);
+  const bool dupsort = db_flags & MDB_DUPSORT;
+  const auto key = [&](const std::size_t i) { return batch[i].first; };
+  const auto cmp = [&](const std::string_view a, const std::string_view b) {
+    const MDB_val aV{a.size(), const_cast<char*>(a.data())};
+    const MDB_val bV{b.size(), const_cast<char*>(b.data())};
+    return lmdb::dbi_cmp(txn, handle(), &aV, &bV);
+  };
+
+  std::vector<std::size_t> order(batch.size());
+  for (std::size_t i = 0; i < order.size(); i++) order[i] = i;
+  if (db_flags & (MDB_REVERSEKEY | MDB_INTEGERKEY)) {
+    std::stable_sort(order.begin(), order.end(), [&](const std::size_t a, const std::size_t b) { return cmp(key(a), key(b)) < 0; });
+  } else {
+    std::vector<std::size_t> tmp(order.size());
+    internal::radix_sort(order.data(), tmp.data(), order.size(), key, 0);
+  }
+
+  auto cursor = lmdb::cursor::open(txn, handle());
+  std::string_view last, val;
+  bool has_max = cursor.get(last, val, MDB_LAST);
+  const std::string last_copy{last};
+  std::string_view max{last_copy};
+
+  std::size_t result = 0;
+  for (std::size_t i = 0; i < order.size(); i++) {
+    const auto& [k, v] = batch[order[i]];
+    // The sort is stable, so the last writer of a key comes last
+    if (!dupsort && i + 1 < order.size() && key(order[i + 1]) == k) continue;
+    // Checked per key, as a custom comparator may not follow the byte-wise order
+    const bool append = !has_max || cmp(k, max) > 0;
+    if (append) max = k, has_max = true;
+    // In a `MDB_DUPSORT` database, an existing key/value pair isn't stored again
+    result += cursor.put(k, v, put_flags | (append ? MDB_APPEND : 0) | (dupsort ? MDB_NODUPDATA : 0));
+  }
+  return result;
+}
+
+inline std::size_t
+lmdb::dbi::delete_range(MDB_txn* const txn,
+                        const std::string_view lo,
+                        const std::string_view hi,
+                        const std::size_t limit) {
+  const MDB_val hiV{hi.size(), const_cast<char*>(hi.data())};
+  const auto before = [&](const std::string_view key) {
+    const MDB_val keyV{key.size(), const_cast<char*>(key.data())};
+    return hi.empty() || lmdb::dbi_cmp(txn, handle(), &keyV, &hiV) < 0;
+  };
+
+  auto cursor = lmdb::cursor::open(txn, handle());
+  std::string_view key{lo}, val;
+  if (!cursor.get(key, val, lo.empty() ? MDB_FIRST : MDB_SET_RANGE) || !before(key)) return 0;
+
+  // Short-circuit when the range starts at the first key and ends past the last one
+  const std::size_t entries = size(txn);
+  if (entries <= limit) {
+    std::string_view first, last;
+    if (cursor.get(first, val, MDB_FIRST) && first == key && cursor.get(last, val, MDB_LAST) && before(last)) {
+      drop(txn, false);
+      return entries;
+    }
+    key = lo;
+    if (!cursor.get(key, val, lo.empty() ? MDB_FIRST : MDB_SET_RANGE)) return 0;
+  }
+
+  const bool dupsort = flags(txn) & MDB_DUPSORT;
+  std::size_t result = 0;
+  while (result < limit && before(key)) {
+    result += dupsort ? cursor.count() : 1;
+    cursor.del(dupsort ? MDB_NODUPDATA : 0);
+    // After a delete, the cursor already points at the next key
+    if (!cursor.get(key, val, MDB_NEXT)) break;
+  }
+  return result;
+}
+
+inline std::size_t
+lmdb::dbi::delete_range(MDB_env* const env,
+                        const std::string_view lo,
+                        const std::string_view hi,
+                        const std::size_t batch) {
+  std::size_t result = 0;
+  for (;;) {
+    auto txn = lmdb::txn::begin(env);
+    const std::size_t n = delete_range(txn, lo, hi, std::max<std::size_t>(batch, 1));
+    txn.commit();
+    result += n;
+    if (n < std::max<std::size_t>(batch, 1)) return result;
+  }
+}
+
+inline std::size_t
+lmdb::dbi::delete_prefix(MDB_txn* const txn,
+                         const std::string_view prefix,
+                         const std::size_t limit) {
+  return delete_range(txn, prefix, prefix_end(prefix), limit);
+}
+
+inline std::size_t
+lmdb::dbi::delete_prefix(MDB_env* const env,
+                         const std::string_view prefix,
+                         const std::size_t batch) {
+  return delete_range(env, prefix, prefix_end(prefix), batch);
+}
+
 namespace lmdb {
   /**
    * Creates a std::string_view that points to the memory pointed to by v.
@@ -1727,6 +3482,4324 @@ namespace lmdb {
   }
 }
 
+/**
+ * Serializes values of type `T` for `dbi::put_encoded()` and `cursor::put_encoded()`,
+ * which write them directly into space reserved in the map. Specialize it for your
+ * own types with two static members:
+ *
+ *   - `std::size_t size(const T& value)` returns the encoded size;
+ *   - `void encode(const T& value, char* data)` writes exactly that many bytes.
+ *
+ * Trivially copyable types are copied as is, and strings (including C strings,
+ * without the terminating NUL) as their bytes. Other pointers and arrays have no
+ * encoder, as copying them would store an address or depend on the array's bound.
+ */
+template<typename T>
+struct lmdb::encoder<T, std::enable_if_t<std::is_trivially_copyable_v<T> &&
+                                         !std::is_array_v<T> && !std::is_pointer_v<T>>> {
+  static std::size_t size(const T&) noexcept {
+    return sizeof(T);
+  }
+
+  static void encode(const T& value, char* const data) noexcept {
+    std::memcpy(data, std::addressof(value), sizeof(T));
+  }
+};
+
+template<>
+struct lmdb::encoder<std::string_view> {
+  static std::size_t size(const std::string_view value) noexcept {
+    return value.size();
+  }
+
+  static void encode(const std::string_view value, char* const data) noexcept {
+    if (!value.empty()) std::memcpy(data, value.data(), value.size());
+  }
+};
+
+template<>
+struct lmdb::encoder<std::string> : lmdb::encoder<std::string_view> {};
+
+template<>
+struct lmdb::encoder<const char*> {
+  static std::size_t size(const char* const value) noexcept {
+    return std::strlen(value);
+  }
+
+  static void encode(const char* const value, char* const data) noexcept {
+    std::memcpy(data, value, std::strlen(value));
+  }
+};
+
+template<>
+struct lmdb::encoder<char*> : lmdb::encoder<const char*> {};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Space Accounting */
+
+/**
+ * Free space of an environment, as reported by `env::freelist()`.
+ */
+struct lmdb::freelist_stat {
+  std::size_t psize;
+  /** Pages in use by the data file (`me_last_pgno + 1`). */
+  std::size_t used_pages;
+  /** Pages the memory map can hold (`me_mapsize / psize`). */
+  std::size_t map_pages;
+  /** Pages recorded in the freelist. */
+  std::size_t free_pages;
+  /** Free pages that the next write transaction may reuse. */
+  std::size_t reusable_pages;
+  /** Free pages that can't be reused until readers of older snapshots finish. */
+  std::size_t pinned_pages;
+  /** Number of freelist records (one per transaction that freed pages). */
+  std::size_t entries;
+  /** Pages occupied by the free-page database itself. */
+  std::size_t freedb_pages;
+  /** Oldest snapshot still in use; records of later transactions are pinned. */
+  std::size_t oldest_txnid;
+  /** Number of runs of consecutive free pages. */
+  std::size_t runs;
+  /** Length of the longest run of consecutive free pages. */
+  std::size_t largest_run;
+
+  /**
+   * Returns the number of pages holding live data.
+   */
+  std::size_t live_pages() const noexcept {
+    return used_pages - free_pages;
+  }
+
+  /**
+   * Returns the fraction of the data file that is free. This is roughly what compaction would reclaim.
+   */
+  double free_ratio() const noexcept {
+    return used_pages ? double(free_pages) / used_pages : 0.0;
+  }
+
+  /**
+   * Returns 0 when all free pages are in one run, approaching 1 as they are scattered.
+   * Requests for multi-page (overflow) values can only be served from runs.
+   */
+  double fragmentation() const noexcept {
+    return free_pages ? 1.0 - double(largest_run) / free_pages : 0.0;
+  }
+};
+
+inline lmdb::freelist_stat
+lmdb::env::freelist(MDB_txn* const txn) {
+  freelist_stat result{};
+  MDB_stat st;
+  MDB_envinfo info;
+  lmdb::env_stat(handle(), &st);
+  lmdb::env_info(handle(), &info);
+  result.psize = st.ms_psize;
+  result.used_pages = info.me_last_pgno + 1;
+  result.map_pages = info.me_mapsize / st.ms_psize;
+
+  lmdb::dbi_stat(txn, 0, &st);
+  result.freedb_pages = st.ms_branch_pages + st.ms_leaf_pages + st.ms_overflow_pages;
+
+  result.oldest_txnid = info.me_last_txnid;
+  for (const auto& r : readers()) result.oldest_txnid = std::min(result.oldest_txnid, r.txnid);
+
+  // Each record is keyed by the ID of the transaction that freed the pages, and holds
+  // an IDL: a count followed by that many page numbers, in descending order.
+  std::vector<std::pair<std::size_t, std::size_t>> runs;
+  auto cursor = lmdb::cursor::open(txn, 0);
+  std::string_view key, val;
+  for (bool found = cursor.get(key, val, MDB_FIRST); found; found = cursor.get(key, val, MDB_NEXT)) {
+    if (key.size() != sizeof(std::size_t) || val.size() < sizeof(std::size_t)) error::raise("env::freelist", MDB_CORRUPTED);
+    const std::size_t txnid = internal::load<std::size_t>(key.data());
+    const char* const idl = val.data();
+    const std::size_t count = internal::load<std::size_t>(idl);
+    if (count > val.size() / sizeof(std::size_t) - 1) error::raise("env::freelist", MDB_CORRUPTED);
+
+    result.entries++;
+    result.free_pages += count;
+    (txnid < result.oldest_txnid ? result.reusable_pages : result.pinned_pages) += count;
+
+    for (std::size_t i = count; i >= 1; i--) {
+      const std::size_t pgno = internal::load<std::size_t>(idl + i * sizeof(std::size_t));
+      if (!runs.empty() && runs.back().second == pgno) runs.back().second++;
+      else runs.emplace_back(pgno, pgno + 1);
+    }
+  }
+
+  std::sort(runs.begin(), runs.end());
+  std::size_t start = 0, end = 0;
+  for (const auto& r : runs) {
+    if (result.runs && r.first <= end) {
+      end = std::max(end, r.second);
+    } else {
+      result.runs++;
+      start = r.first;
+      end = r.second;
+    }
+    result.largest_run = std::max(result.largest_run, end - start);
+  }
+
+  return result;
+}
+
+/**
+ * Space used by one database, as reported by `env::space()`.
+ */
+struct lmdb::dbi_space {
+  /** Name of the database, or empty for the main database. */
+  std::string name;
+  unsigned int flags;
+  MDB_stat stat;
+  /** Number of entries the size estimates are based on. */
+  std::size_t sampled;
+  double avg_key_size;
+  double avg_value_size;
+  /** Bytes occupied per entry beyond its key and value: node headers, branch pages and unused page space. */
+  double overhead_per_entry;
+  /** Estimated fraction of leaf page space holding nodes. */
+  double leaf_fill;
+
+  /**
+   * Returns the number of pages occupied by this database.
+   */
+  std::size_t pages() const noexcept {
+    return stat.ms_branch_pages + stat.ms_leaf_pages + stat.ms_overflow_pages;
+  }
+
+  /**
+   * Returns the number of bytes occupied by this database.
+   */
+  std::size_t bytes() const noexcept {
+    return pages() * stat.ms_psize;
+  }
+};
+
+inline std::vector<lmdb::dbi_space>
+lmdb::env::space(MDB_txn* const txn,
+                 const std::size_t samples) {
+  std::vector<std::string> names{""};
+  for (auto& name : dbi::names(txn)) names.push_back(std::move(name));
+
+  std::vector<dbi_space> result;
+  for (auto& name : names) {
+    const auto handle = lmdb::dbi::open(txn, name.empty() ? nullptr : name.c_str());
+    dbi_space s{};
+    s.name = std::move(name);
+    s.flags = handle.flags(txn);
+    s.stat = handle.stat(txn);
+
+    // A node holds a 8-byte header, the key and the value (or the 8-byte number of
+    // its first overflow page, when the node would exceed `internal::node_max()`).
+    const std::size_t node_max = internal::node_max(s.stat.ms_psize);
+    std::size_t keys = 0, vals = 0, nodes = 0;
+    auto cursor = lmdb::cursor::open(txn, handle);
+    std::string_view key, val;
+    for (bool found = cursor.get(key, val, MDB_FIRST); found && s.sampled < samples; found = cursor.get(key, val, MDB_NEXT)) {
+      s.sampled++;
+      keys += key.size();
+      vals += val.size();
+      nodes += 8 + 2 + key.size() + (8 + key.size() + val.size() > node_max ? sizeof(std::size_t) : val.size());
+    }
+
+    if (s.sampled) {
+      s.avg_key_size = double(keys) / s.sampled;
+      s.avg_value_size = double(vals) / s.sampled;
+      s.overhead_per_entry = double(s.bytes()) / s.stat.ms_entries - s.avg_key_size - s.avg_value_size;
+      if (s.stat.ms_leaf_pages) {
+        s.leaf_fill = std::min(1.0, double(nodes) / s.sampled * s.stat.ms_entries /
+                                    (double(s.stat.ms_leaf_pages) * (s.stat.ms_psize - internal::page_header_size)));
+      }
+    }
+    result.push_back(std::move(s));
+  }
+
+  std::sort(result.begin(), result.end(), [](const dbi_space& a, const dbi_space& b) { return a.bytes() > b.bytes(); });
+  return result;
+}
+
+namespace lmdb {
+  struct size_histogram;
+  struct size_profile_options;
+  struct size_profile;
+}
+
+/**
+ * Distribution of sizes in bytes, in power-of-two buckets.
+ */
+struct lmdb::size_histogram {
+  /** `buckets[0]` counts sizes of 0; `buckets[i]` counts sizes in [2^(i-1), 2^i). */
+  std::array<std::size_t, 65> buckets{};
+  std::size_t count = 0;
+  std::size_t total = 0;
+  std::size_t min = 0;
+  std::size_t max = 0;
+
+  /**
+   * Records one size.
+   */
+  void add(const std::size_t size) noexcept {
+    std::size_t i = 0;
+    while (i < 64 && (size >> i)) i++;
+    buckets[i]++;
+    min = count ? std::min(min, size) : size;
+    max = std::max(max, size);
+    count++;
+    total += size;
+  }
+
+  /**
+   * Adds the sizes recorded by another histogram.
+   */
+  void merge(const size_histogram& other) noexcept {
+    if (!other.count) return;
+    for (std::size_t i = 0; i < buckets.size(); i++) buckets[i] += other.buckets[i];
+    min = count ? std::min(min, other.min) : other.min;
+    max = std::max(max, other.max);
+    count += other.count;
+    total += other.total;
+  }
+
+  double mean() const noexcept {
+    return count ? double(total) / count : 0.0;
+  }
+
+  /**
+   * Returns an upper bound for the `q` quantile (0 to 1): the end of the bucket holding it.
+   */
+  std::size_t quantile(const double q) const noexcept {
+    const double target = q * count;
+    std::size_t seen = 0;
+    for (std::size_t i = 0; i < buckets.size(); i++) {
+      seen += buckets[i];
+      if (seen && seen >= target) return i ? std::min(max, (std::size_t(1) << std::min<std::size_t>(i, 63)) - 1) : 0;
+    }
+    return max;
+  }
+};
+
+/**
+ * Options for `size_profile::scan()`.
+ */
+struct lmdb::size_profile_options {
+  /** Scan ranges of the database in parallel, each in its own read-only transaction. */
+  unsigned int threads = 1;
+  /** Entries to scan, in short runs spread over the database, or 0 to scan all of them. */
+  std::size_t samples = 0;
+  /** Keys are grouped by their first `prefix_bytes` bytes. */
+  std::size_t prefix_bytes = 4;
+  /** Number of key prefixes to report. */
+  std::size_t top_prefixes = 10;
+};
+
+/**
+ * Key and value sizes of a database, as reported by `size_profile::scan()`.
+ * When only a sample was scanned, page counts are extrapolated to the whole database.
+ */
+struct lmdb::size_profile {
+  MDB_stat stat;
+  unsigned int flags;
+  /** Entries scanned (each duplicate counts). */
+  std::size_t entries;
+  /** Distinct keys scanned. */
+  std::size_t keys;
+  size_histogram key_sizes;
+  size_histogram value_sizes;
+  /** Duplicates per key (`MDB_DUPSORT` databases only). */
+  size_histogram dup_counts;
+  /** Values too large for a leaf node, which are stored on overflow pages. */
+  std::size_t overflow_values;
+  /** The most common key prefixes, with their number of keys, most common first. */
+  std::vector<std::pair<std::string, std::size_t>> prefixes;
+  /** Average number of leading bytes each key shares with the previous key. */
+  double shared_prefix;
+
+  /** Pages that eliding the bytes each key shares with the previous one would save. */
+  std::size_t prefix_pages;
+  /** Unused space at the end of overflow values, in pages. Splitting large values into
+      leaf-sized chunks would recover most of it. */
+  std::size_t overflow_slack_pages;
+  /** Pages that `MDB_DUPFIXED` would save, when every duplicate has the same size. */
+  std::size_t dupfixed_pages;
+
+  /** Entries read at each place a sample is taken from. */
+  static constexpr std::size_t sample_run = 16;
+  /** Most places a sample is taken from. */
+  static constexpr std::size_t max_sample_runs = 4096;
+
+  /**
+   * Scans a database with a cursor and profiles its keys and values.
+   *
+   * The database is divided at `dbi::split_points()`, which needs a read-only
+   * transaction. A sample is taken as runs of about `sample_run` entries, one from
+   * the start of each range, so it is spread over the whole key space.
+   *
+   * @param txn a transaction handle. In a write transaction, whose pages aren't in
+   *        the memory map, the whole database is scanned by one cursor, ignoring
+   *        `opts.threads` and `opts.samples`.
+   * @param dbi a database handle
+   * @param opts
+   * @throws lmdb::error on failure
+   * @note With `opts.threads > 1`, ranges are scanned in their own transactions,
+   *       which see the latest committed snapshot rather than `txn`.
+   */
+  static size_profile scan(MDB_txn* const txn,
+                           const MDB_dbi dbi,
+                           const size_profile_options& opts = {}) {
+    size_profile result{};
+    lmdb::dbi_stat(txn, dbi, &result.stat);
+    lmdb::dbi_flags(txn, dbi, &result.flags);
+    const bool dupsort = result.flags & MDB_DUPSORT;
+    const std::size_t psize = result.stat.ms_psize;
+    const std::size_t node_max = internal::node_max(psize);
+
+    const bool read_only = internal::read_only(txn);
+    const std::size_t threads = read_only ? std::max(1U, opts.threads) : 1;
+    const std::size_t samples = read_only ? opts.samples : 0;
+    const std::size_t parts = std::max<std::size_t>(threads, std::min(samples / sample_run, max_sample_runs));
+    const auto bounds = parts > 1 ? lmdb::dbi{dbi}.split_points(txn, parts) : std::vector<std::string>{};
+    const std::size_t ranges = bounds.size() + 1;
+    const std::size_t limit = samples ? (samples + ranges - 1) / ranges : SIZE_MAX;
+
+    // Per-range results. Keys are sorted, so each prefix forms one run: a run can only
+    // be split between ranges as the last run of one and the first run of the next.
+    struct part {
+      size_profile p{};
+      std::size_t node_bytes = 0, shared = 0, pairs = 0, slack = 0, dup_headers = 0;
+      std::size_t fixed_size = SIZE_MAX;
+      bool mixed_sizes = false;
+      std::vector<std::pair<std::string, std::size_t>> runs;
+    };
+
+    const auto scan_range = [&](MDB_txn* const t, const std::size_t r) {
+      part out;
+      const std::string lo = r ? bounds[r - 1] : std::string(), hi = r < bounds.size() ? bounds[r] : std::string();
+      const MDB_val hiV{hi.size(), const_cast<char*>(hi.data())};
+      std::string prev;
+      std::vector<std::pair<std::string, std::size_t>> interior;
+
+      auto cursor = lmdb::cursor::open(t, dbi);
+      std::string_view key{lo}, val;
+      for (bool found = cursor.get(key, val, lo.empty() ? MDB_FIRST : MDB_SET_RANGE);
+           found && out.p.entries < limit;
+           found = cursor.get(key, val, dupsort ? MDB_NEXT_NODUP : MDB_NEXT)) {
+        const MDB_val keyV{key.size(), const_cast<char*>(key.data())};
+        if (!hi.empty() && lmdb::dbi_cmp(t, dbi, &keyV, &hiV) >= 0) break;
+
+        out.p.keys++;
+        out.p.key_sizes.add(key.size());
+        if (out.p.keys > 1) {
+          std::size_t n = 0;
+          while (n < key.size() && n < prev.size() && key[n] == prev[n]) n++;
+          out.shared += n;
+          out.pairs++;
+        }
+        prev.assign(key);
+
+        const std::string_view prefix = key.substr(0, opts.prefix_bytes);
+        if (!out.runs.empty() && out.runs.back().first == prefix) {
+          out.runs.back().second++;
+        } else {
+          // Keep the first run and the current one, plus the largest runs in between.
+          if (out.runs.size() == 2) {
+            interior.push_back(std::move(out.runs.back()));
+            out.runs.pop_back();
+            if (interior.size() >= 4 * std::max<std::size_t>(opts.top_prefixes, 1)) {
+              std::sort(interior.begin(), interior.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+              interior.resize(opts.top_prefixes);
+            }
+          }
+          out.runs.emplace_back(std::string(prefix), 1);
+        }
+
+        std::size_t dups = 1;
+        if (dupsort) {
+          dups = cursor.count();
+          out.p.dup_counts.add(dups);
+        }
+        for (std::size_t d = 0; d < dups; d++) {
+          if (d && !cursor.get(key, val, MDB_NEXT_DUP)) break;
+          out.p.entries++;
+          out.p.value_sizes.add(val.size());
+          if (dupsort) {
+            // Duplicates are keys of a sub-database, each in a node of its own.
+            out.node_bytes += 8 + 2 + val.size();
+            out.dup_headers += 8 + 2;
+            if (out.fixed_size == SIZE_MAX) out.fixed_size = val.size();
+            else if (out.fixed_size != val.size()) out.mixed_sizes = true;
+          } else if (8 + key.size() + val.size() > node_max) {
+            const std::size_t pages = (internal::page_header_size + val.size() + psize - 1) / psize;
+            out.p.overflow_values++;
+            out.slack += pages * psize - internal::page_header_size - val.size();
+            out.node_bytes += 8 + 2 + key.size() + sizeof(std::size_t);
+          } else {
+            out.node_bytes += 8 + 2 + key.size() + val.size();
+          }
+        }
+        if (dupsort) out.node_bytes += 8 + 2 + key.size();
+      }
+
+      if (out.runs.size() == 2) interior.push_back(std::move(out.runs.back())), out.runs.pop_back();
+      out.runs.insert(out.runs.end(), std::make_move_iterator(interior.begin()), std::make_move_iterator(interior.end()));
+      return out;
+    };
+
+    std::vector<part> results;
+    if (threads == 1 || ranges == 1) {
+      for (std::size_t r = 0; r < ranges; r++) results.push_back(scan_range(txn, r));
+    } else {
+      MDB_env* const env = lmdb::txn_env(txn);
+      std::deque<std::future<part>> pending;
+      const auto drain = [&] {
+        results.push_back(pending.front().get());
+        pending.pop_front();
+      };
+      for (std::size_t r = 0; r < ranges; r++) {
+        pending.push_back(std::async(std::launch::async, [&, env, r] {
+          auto t = txn::begin(env, nullptr, MDB_RDONLY);
+          return scan_range(t, r);
+        }));
+        if (pending.size() >= threads) drain();
+      }
+      while (!pending.empty()) drain();
+    }
+
+    std::size_t node_bytes = 0, shared = 0, pairs = 0, slack = 0, dup_headers = 0, fixed_size = SIZE_MAX;
+    bool mixed_sizes = false;
+    std::map<std::string, std::size_t> prefixes;
+    for (auto& r : results) {
+      result.entries += r.p.entries;
+      result.keys += r.p.keys;
+      result.key_sizes.merge(r.p.key_sizes);
+      result.value_sizes.merge(r.p.value_sizes);
+      result.dup_counts.merge(r.p.dup_counts);
+      result.overflow_values += r.p.overflow_values;
+      node_bytes += r.node_bytes;
+      shared += r.shared;
+      pairs += r.pairs;
+      slack += r.slack;
+      dup_headers += r.dup_headers;
+      if (r.fixed_size != SIZE_MAX) {
+        if (fixed_size == SIZE_MAX) fixed_size = r.fixed_size;
+        mixed_sizes |= r.mixed_sizes || fixed_size != r.fixed_size;
+      }
+      for (auto& run : r.runs) prefixes[std::move(run.first)] += run.second;
+    }
+
+    result.prefixes.assign(prefixes.begin(), prefixes.end());
+    std::stable_sort(result.prefixes.begin(), result.prefixes.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+    if (result.prefixes.size() > opts.top_prefixes) result.prefixes.resize(opts.top_prefixes);
+    if (pairs) result.shared_prefix = double(shared) / pairs;
+
+    // Savings in bytes are converted to pages at the database's current leaf density,
+    // and scaled from the entries scanned to all of them.
+    if (result.entries) {
+      const double scale = double(result.stat.ms_entries) / result.entries;
+      const double per_page = node_bytes && result.stat.ms_leaf_pages
+                                ? double(node_bytes) * scale / result.stat.ms_leaf_pages
+                                : double(psize - internal::page_header_size);
+      result.prefix_pages = std::size_t(shared * scale / per_page);
+      result.overflow_slack_pages = std::size_t(slack * scale / psize);
+      if (dupsort && !(result.flags & MDB_DUPFIXED) && !mixed_sizes) {
+        result.dupfixed_pages = std::size_t(dup_headers * scale / per_page);
+      }
+    }
+    return result;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Sharding */
+
+namespace lmdb {
+  class sharded_env;
+  class sharded_txn;
+  class sharded_dbi;
+  class sharded_batch;
+  class sharded_cursor;
+}
+
+/**
+ * A set of environments (shards) that together hold one keyspace. Each key is
+ * routed to exactly one shard, by hash or by range. Since every shard has its
+ * own write lock, writes to different shards can proceed in parallel.
+ *
+ * @note Transactions are per shard: there is no atomicity or snapshot consistency across shards.
+ * @note Instances of this class are movable, but not copyable.
+ */
+class lmdb::sharded_env {
+protected:
+  std::vector<env> _shards;
+  std::vector<std::string> _bounds;
+
+public:
+  /**
+   * Opens (creating if necessary) `shards` environments in the subdirectories
+   * `path/0`, `path/1`, ...
+   *
+   * @param path the parent directory
+   * @param shards number of shards
+   * @param configure if set, called on each environment before it is opened (ie to `set_mapsize()`)
+   * @param bounds if empty, keys are routed by hash. Otherwise, `shards - 1` sorted keys:
+   *               shard `i` holds keys in `[bounds[i - 1], bounds[i])`, in byte-wise order
+   * @param flags
+   * @param mode
+   * @throws lmdb::error on failure
+   */
+  static sharded_env open(const std::string& path,
+                          const std::size_t shards,
+                          const std::function<void(env&)>& configure = {},
+                          std::vector<std::string> bounds = {},
+                          const unsigned int flags = env::default_flags,
+                          const mode mode = env::default_mode) {
+    std::vector<env> envs;
+    for (std::size_t i = 0; i < shards; i++) {
+      const std::string dir = path + "/" + std::to_string(i);
+      std::error_code ec;
+      std::filesystem::create_directories(dir, ec);
+      if (ec) error::raise("sharded_env::open", ec.value());
+      envs.push_back(env::create());
+      if (configure) configure(envs.back());
+      envs.back().open(dir.c_str(), flags, mode);
+    }
+    return sharded_env{std::move(envs), std::move(bounds)};
+  }
+
+  /**
+   * Constructor.
+   *
+   * @param shards opened environments
+   * @param bounds see `open()`
+   * @throws lmdb::error if `bounds` is neither empty nor `shards.size() - 1` sorted keys
+   */
+  sharded_env(std::vector<env>&& shards,
+              std::vector<std::string> bounds = {})
+    : _shards{std::move(shards)}, _bounds{std::move(bounds)} {
+    if (_shards.empty() || (!_bounds.empty() && _bounds.size() != _shards.size() - 1) ||
+        !std::is_sorted(_bounds.begin(), _bounds.end())) {
+      error::raise("sharded_env", EINVAL);
+    }
+  }
+
+  sharded_env(sharded_env&& other) noexcept = default;
+  sharded_env& operator=(sharded_env&& other) noexcept = default;
+
+  /**
+   * Returns the number of shards.
+   */
+  std::size_t size() const noexcept {
+    return _shards.size();
+  }
+
+  /**
+   * Returns one shard.
+   */
+  env& shard(const std::size_t i) noexcept {
+    return _shards[i];
+  }
+
+  /**
+   * Returns the index of the shard that holds a key.
+   */
+  std::size_t route(const std::string_view key) const noexcept {
+    if (!_bounds.empty()) {
+      return std::upper_bound(_bounds.begin(), _bounds.end(), key,
+                              [](const std::string_view k, const std::string& b) { return k < b; }) - _bounds.begin();
+    }
+    // FNV-1a: stable across processes and platforms, unlike std::hash
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+    for (const char c : key) {
+      h ^= static_cast<unsigned char>(c);
+      h *= 0x100000001b3ULL;
+    }
+    return static_cast<std::size_t>(h % _shards.size());
+  }
+
+  /**
+   * Runs `fn(i, txn)` in a write transaction on each selected shard, one thread
+   * per shard, and commits each transaction when its function returns.
+   *
+   * @param fn called as `fn(std::size_t shard, lmdb::txn& txn)`
+   * @param selected if not empty, one flag per shard; only shards with a true flag are written
+   * @throws the first exception raised by any shard, or `std::system_error` if a thread
+   *         can't be started (after the started ones finish). Shards that succeeded stay committed.
+   */
+  template<typename F>
+  void parallel(F&& fn,
+                const std::vector<bool>& selected = {}) {
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(_shards.size());
+    threads.reserve(_shards.size());
+    try {
+      for (std::size_t i = 0; i < _shards.size(); i++) {
+        if (!selected.empty() && !selected[i]) continue;
+        threads.emplace_back([this, i, &fn, &errors] {
+          try {
+            auto t = txn::begin(_shards[i]);
+            fn(i, t);
+            t.commit();
+          } catch (...) {
+            errors[i] = std::current_exception();
+          }
+        });
+      }
+    } catch (...) {
+      // Destroying a joinable std::thread would terminate the process
+      for (auto& t : threads) t.join();
+      throw;
+    }
+    for (auto& t : threads) t.join();
+    for (auto& e : errors) {
+      if (e) std::rethrow_exception(e);
+    }
+  }
+
+  /**
+   * Flushes data buffers of all shards to disk.
+   *
+   * @throws lmdb::error on failure
+   */
+  void sync(const bool force = true) {
+    for (auto& e : _shards) e.sync(force);
+  }
+};
+
+/**
+ * A transaction over a `sharded_env`. Read-only transactions on individual shards
+ * are begun on first use.
+ *
+ * A write transaction holds one LMDB write lock per shard. To rule out deadlocks
+ * between writers touching the same shards, these locks are always taken in
+ * ascending shard order: the shards named at `begin()` (all by default) are begun
+ * up front, and a shard used later is only begun if no higher shard is held.
+ *
+ * @note Instances of this class are movable, but not copyable.
+ */
+class lmdb::sharded_txn {
+protected:
+  sharded_env* _env;
+  unsigned int _flags;
+  std::vector<txn> _txns;
+
+  bool read_only() const noexcept {
+    return (_flags & MDB_RDONLY) != 0;
+  }
+
+public:
+  /**
+   * Begins a transaction.
+   *
+   * @param env the sharded environment
+   * @param flags ie `MDB_RDONLY`
+   * @param shards for a write transaction, the shards to lock up front (all if empty)
+   * @throws lmdb::error on failure
+   */
+  static sharded_txn begin(sharded_env& env,
+                           const unsigned int flags = txn::default_flags,
+                           const std::vector<std::size_t>& shards = {}) {
+    return sharded_txn{env, flags, shards};
+  }
+
+  sharded_txn(sharded_env& env,
+              const unsigned int flags,
+              const std::vector<std::size_t>& shards = {})
+    : _env{&env}, _flags{flags} {
+    _txns.reserve(env.size());
+    for (std::size_t i = 0; i < env.size(); i++) _txns.emplace_back(nullptr);
+    if (read_only()) return;
+
+    std::vector<bool> wanted(env.size(), shards.empty());
+    for (const auto i : shards) wanted.at(i) = true;
+    for (std::size_t i = 0; i < env.size(); i++) {
+      if (wanted[i]) _txns[i] = txn::begin(env.shard(i), nullptr, _flags);
+    }
+  }
+
+  sharded_txn(sharded_txn&& other) noexcept = default;
+  sharded_txn& operator=(sharded_txn&& other) noexcept = default;
+
+  /**
+   * Returns the sharded environment.
+   */
+  sharded_env& env() const noexcept {
+    return *_env;
+  }
+
+  /**
+   * Returns the transaction on one shard, beginning it if necessary.
+   *
+   * @throws lmdb::error on failure, or with `MDB_BAD_TXN` if this is a write
+   *         transaction, the shard wasn't locked at `begin()` and a higher shard is
+   */
+  txn& shard(const std::size_t i) {
+    if (!_txns[i]) {
+      if (!read_only()) {
+        for (std::size_t j = i + 1; j < _txns.size(); j++) {
+          if (_txns[j]) error::raise("sharded_txn::shard", MDB_BAD_TXN);
+        }
+      }
+      _txns[i] = txn::begin(_env->shard(i), nullptr, _flags);
+    }
+    return _txns[i];
+  }
+
+  /**
+   * Commits the transactions on all shards that were used, in shard order.
+   *
+   * @throws lmdb::error on failure. Shards before the failing one stay committed.
+   */
+  void commit() {
+    for (auto& t : _txns) {
+      if (t) t.commit();
+    }
+  }
+
+  /**
+   * Aborts the transactions on all shards.
+   */
+  void abort() noexcept {
+    for (auto& t : _txns) {
+      if (t) t.abort();
+    }
+  }
+};
+
+/**
+ * Write operations for a `sharded_env`, grouped by shard, to be applied by
+ * `sharded_dbi::write()` with one thread per shard.
+ */
+class lmdb::sharded_batch {
+public:
+  struct op {
+    std::string key;
+    std::string val;
+    bool del;
+  };
+
+protected:
+  const sharded_env* _env;
+  std::vector<std::vector<op>> _ops;
+
+public:
+  /**
+   * Constructor.
+   *
+   * @param env the sharded environment, used for routing
+   */
+  explicit sharded_batch(const sharded_env& env)
+    : _env{&env}, _ops(env.size()) {}
+
+  /**
+   * Adds a key/value pair to store.
+   */
+  void put(const std::string_view key,
+           const std::string_view val) {
+    _ops[_env->route(key)].push_back(op{std::string(key), std::string(val), false});
+  }
+
+  /**
+   * Adds a key to delete.
+   */
+  void del(const std::string_view key) {
+    _ops[_env->route(key)].push_back(op{std::string(key), std::string(), true});
+  }
+
+  /**
+   * Returns the operations routed to one shard, in insertion order.
+   */
+  const std::vector<op>& shard(const std::size_t i) const noexcept {
+    return _ops[i];
+  }
+
+  /**
+   * Removes all operations.
+   */
+  void clear() noexcept {
+    for (auto& ops : _ops) ops.clear();
+  }
+};
+
+/**
+ * A database present on every shard of a `sharded_env`, with the same name and flags.
+ */
+class lmdb::sharded_dbi {
+protected:
+  std::vector<MDB_dbi> _handles;
+
+public:
+  /**
+   * Opens the database on every shard.
+   *
+   * @param txn the sharded transaction
+   * @param name the database name, or nullptr
+   * @param flags dbi flags, ie MDB_CREATE
+   * @throws lmdb::error on failure
+   */
+  static sharded_dbi open(sharded_txn& txn,
+                          const char* const name = nullptr,
+                          const unsigned int flags = dbi::default_flags) {
+    sharded_dbi result;
+    for (std::size_t i = 0; i < txn.env().size(); i++) {
+      result._handles.push_back(dbi::open(txn.shard(i), name, flags).handle());
+    }
+    return result;
+  }
+
+  /**
+   * Returns the database handle on one shard.
+   */
+  MDB_dbi shard(const std::size_t i) const noexcept {
+    return _handles[i];
+  }
+
+  /**
+   * Returns the number of records in the database, over all shards.
+   *
+   * @param txn the sharded transaction
+   * @throws lmdb::error on failure
+   */
+  std::size_t size(sharded_txn& txn) const {
+    std::size_t result = 0;
+    for (std::size_t i = 0; i < _handles.size(); i++) result += dbi{_handles[i]}.size(txn.shard(i));
+    return result;
+  }
+
+  /**
+   * Retrieves a key/value pair from the shard that holds the key.
+   *
+   * @throws lmdb::error on failure
+   */
+  bool get(sharded_txn& txn,
+           const std::string_view key,
+           std::string_view& val) const {
+    const std::size_t i = txn.env().route(key);
+    return dbi{_handles[i]}.get(txn.shard(i), key, val);
+  }
+
+  /**
+   * Stores a key/value pair in the shard that holds the key.
+   *
+   * @throws lmdb::error on failure, or with `MDB_BAD_TXN` if the key's shard
+   *         wasn't locked when `txn` began and a higher shard was
+   */
+  bool put(sharded_txn& txn,
+           const std::string_view key,
+           const std::string_view val,
+           const unsigned int flags = dbi::default_put_flags) {
+    const std::size_t i = txn.env().route(key);
+    return dbi{_handles[i]}.put(txn.shard(i), key, val, flags);
+  }
+
+  /**
+   * Removes a key from the shard that holds it.
+   *
+   * @throws lmdb::error on failure
+   */
+  bool del(sharded_txn& txn,
+           const std::string_view key) {
+    const std::size_t i = txn.env().route(key);
+    return dbi{_handles[i]}.del(txn.shard(i), key);
+  }
+
+  /**
+   * Applies a batch, writing to all affected shards in parallel (one write
+   * transaction and thread per shard).
+   *
+   * @param env the sharded environment
+   * @param batch the operations to apply
+   * @param flags put flags
+   * @throws the first exception raised by any shard. Shards that succeeded stay committed.
+   */
+  void write(sharded_env& env,
+             const sharded_batch& batch,
+             const unsigned int flags = dbi::default_put_flags) {
+    std::vector<bool> selected(env.size());
+    for (std::size_t i = 0; i < env.size(); i++) selected[i] = !batch.shard(i).empty();
+    env.parallel([&](const std::size_t i, txn& t) {
+      dbi d{_handles[i]};
+      for (const auto& op : batch.shard(i)) {
+        if (op.del) d.del(t, op.key);
+        else d.put(t, op.key, op.val, flags);
+      }
+    }, selected);
+  }
+};
+
+/**
+ * A cursor that iterates a `sharded_dbi` in key order, merging the cursors of all shards.
+ *
+ * @note Supports `MDB_FIRST`, `MDB_NEXT`, `MDB_SET_RANGE` and `MDB_GET_CURRENT`.
+ * @note Instances of this class are movable, but not copyable.
+ */
+class lmdb::sharded_cursor {
+protected:
+  struct head {
+    cursor cur;
+    std::string_view key;
+    std::string_view val;
+    bool valid;
+  };
+
+  std::vector<head> _heads;
+  MDB_txn* _cmp_txn;
+  MDB_dbi _cmp_dbi;
+  std::size_t _current;
+
+  bool select() {
+    _current = _heads.size();
+    for (std::size_t i = 0; i < _heads.size(); i++) {
+      if (!_heads[i].valid) continue;
+      if (_current == _heads.size()) {
+        _current = i;
+        continue;
+      }
+      const MDB_val a{_heads[i].key.size(), const_cast<char*>(_heads[i].key.data())};
+      const MDB_val b{_heads[_current].key.size(), const_cast<char*>(_heads[_current].key.data())};
+      if (lmdb::dbi_cmp(_cmp_txn, _cmp_dbi, &a, &b) < 0) _current = i;
+    }
+    return _current != _heads.size();
+  }
+
+public:
+  /**
+   * Opens a cursor on every shard.
+   *
+   * @param txn the sharded transaction
+   * @param dbi the sharded database
+   * @throws lmdb::error on failure
+   */
+  static sharded_cursor open(sharded_txn& txn,
+                             const sharded_dbi& dbi) {
+    sharded_cursor result;
+    for (std::size_t i = 0; i < txn.env().size(); i++) {
+      result._heads.push_back(head{cursor::open(txn.shard(i), dbi.shard(i)), {}, {}, false});
+    }
+    result._cmp_txn = txn.shard(0);
+    result._cmp_dbi = dbi.shard(0);
+    result._current = result._heads.size();
+    return result;
+  }
+
+  /**
+   * Positions the cursor and retrieves the key/value pair there.
+   *
+   * @param key the key to search for with `MDB_SET_RANGE`, and the key found
+   * @param val the value found
+   * @param op one of `MDB_FIRST`, `MDB_NEXT`, `MDB_SET_RANGE` or `MDB_GET_CURRENT`
+   * @throws lmdb::error on failure
+   */
+  bool get(std::string_view& key,
+           std::string_view& val,
+           const MDB_cursor_op op) {
+    switch (op) {
+      case MDB_FIRST:
+      case MDB_SET_RANGE:
+        for (auto& h : _heads) {
+          h.key = key;
+          h.valid = h.cur.get(h.key, h.val, op);
+        }
+        break;
+      case MDB_NEXT:
+        if (_current == _heads.size()) return false;
+        _heads[_current].valid = _heads[_current].cur.get(_heads[_current].key, _heads[_current].val, MDB_NEXT);
+        break;
+      case MDB_GET_CURRENT:
+        if (_current == _heads.size()) return false;
+        break;
+      default:
+        error::raise("sharded_cursor::get", EINVAL);
+    }
+    if (!select()) return false;
+    key = _heads[_current].key;
+    val = _heads[_current].val;
+    return true;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Write Buffer */
+
+namespace lmdb {
+  class write_buffer;
+}
+
+/**
+ * In-memory write buffer (memtable) in front of a database. Puts and deletes are
+ * collected in a sorted map and written to LMDB by `flush()`, in key order and in
+ * a single transaction. Reads merge the buffer with an LMDB snapshot.
+ *
+ * Optionally, buffered writes are appended to a journal file, so that they survive
+ * a crash and are replayed when the buffer is next constructed.
+ *
+ * All methods are thread-safe.
+ *
+ * @note The database must use the default key order, and not be `MDB_DUPSORT`.
+ * @note Instances of this class are not copyable.
+ */
+class lmdb::write_buffer {
+public:
+  class cursor;
+
+protected:
+  /* A missing value is a tombstone. */
+  using table = std::map<std::string, std::optional<std::string>, std::less<>>;
+
+  MDB_env* _env;
+  MDB_dbi _dbi;
+  std::size_t _flush_bytes;
+  mutable std::shared_mutex _mutex;
+  std::shared_ptr<table> _active{std::make_shared<table>()};
+  std::shared_ptr<table> _flushing;
+  std::size_t _bytes{0};
+  std::mutex _flush_mutex;
+  std::string _journal;
+  int _fd{-1};
+  bool _sync;
+  /* While the journal is rewritten, the writes made since its snapshot was taken. */
+  std::optional<std::vector<std::pair<std::string, std::optional<std::string>>>> _rewriting;
+
+  void store(std::string_view key, std::optional<std::string_view> val) {
+    bool full;
+    {
+      std::unique_lock<std::shared_mutex> lock{_mutex};
+      journal_append(key, val);
+      auto it = _active->find(key);
+      if (it == _active->end()) {
+        it = _active->emplace(std::string(key), std::nullopt).first;
+        _bytes += key.size();
+      } else if (it->second) {
+        _bytes -= it->second->size();
+      }
+      if (val) {
+        it->second = std::string(*val);
+        _bytes += val->size();
+      } else {
+        it->second.reset();
+      }
+      full = _flush_bytes && _bytes >= _flush_bytes;
+    }
+    if (full) flush();
+  }
+
+#ifndef _WIN32
+  /* Journal records: op (1 = put, 0 = delete), key length and value length (native
+   * uint32), key, value. A truncated trailing record is ignored on replay. */
+  static void journal_write(const int fd,
+                            const std::string_view key,
+                            const std::optional<std::string_view> val) {
+    const char op = val ? 1 : 0;
+    const std::uint32_t klen = static_cast<std::uint32_t>(key.size());
+    const std::uint32_t vlen = val ? static_cast<std::uint32_t>(val->size()) : 0;
+    std::string record;
+    record.reserve(9 + klen + vlen);
+    record.append(&op, 1);
+    record.append(reinterpret_cast<const char*>(&klen), 4);
+    record.append(reinterpret_cast<const char*>(&vlen), 4);
+    record.append(key);
+    if (val) record.append(*val);
+    for (std::size_t off = 0; off < record.size();) {
+      const ssize_t n = ::write(fd, record.data() + off, record.size() - off);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        error::raise("write_buffer::journal", errno);
+      }
+      off += static_cast<std::size_t>(n);
+    }
+  }
+
+  static void journal_replay(const std::string& path,
+                             table& into) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      if (errno == ENOENT) return;
+      error::raise("write_buffer::journal", errno);
+    }
+    std::string data;
+    char buf[65536];
+    for (;;) {
+      const ssize_t n = ::read(fd, buf, sizeof(buf));
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      data.append(buf, static_cast<std::size_t>(n));
+    }
+    ::close(fd);
+
+    for (std::size_t off = 0; off + 9 <= data.size();) {
+      const std::uint32_t klen = internal::load<std::uint32_t>(data.data() + off + 1);
+      const std::uint32_t vlen = internal::load<std::uint32_t>(data.data() + off + 5);
+      if (data.size() - off - 9 < std::size_t(klen) + vlen) break;
+      std::string key = data.substr(off + 9, klen);
+      if (data[off]) into[std::move(key)] = data.substr(off + 9 + klen, vlen);
+      else into[std::move(key)] = std::nullopt;
+      off += 9 + std::size_t(klen) + vlen;
+    }
+  }
+#endif /* !_WIN32 */
+
+  void journal_append(const std::string_view key,
+                      const std::optional<std::string_view> val) {
+#ifndef _WIN32
+    if (_fd < 0) return;
+    journal_write(_fd, key, val);
+    if (_sync && ::fsync(_fd) != 0) error::raise("write_buffer::journal", errno);
+    if (_rewriting) _rewriting->emplace_back(std::string(key), val ? std::optional<std::string>(*val) : std::nullopt);
+#else
+    (void)key;
+    (void)val;
+#endif
+  }
+
+#ifndef _WIN32
+  /* Syncs the directory holding `path`, so that a rename into it is durable. */
+  static void journal_sync_dir(const std::string& path) {
+    const std::size_t slash = path.rfind('/');
+    const std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) error::raise("write_buffer::journal", errno);
+    const int rc = ::fsync(fd);
+    const int err = errno;
+    ::close(fd);
+    // Some file systems can't sync directories
+    if (rc != 0 && err != EINVAL) error::raise("write_buffer::journal", err);
+  }
+#endif /* !_WIN32 */
+
+  /* Replaces the journal with one holding exactly the buffered writes. The snapshot
+   * is written and synced without holding `_mutex`; writes made meanwhile go to the
+   * old journal and are copied into the new one before it is renamed into place.
+   * Called without `_mutex` held, and by one thread at a time. */
+  void journal_rewrite() {
+#ifndef _WIN32
+    if (_journal.empty()) return;
+    table snapshot;
+    {
+      std::unique_lock<std::shared_mutex> lock{_mutex};
+      snapshot = *_active;
+      _rewriting.emplace();
+    }
+
+    const std::string tmp = _journal + ".tmp";
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    try {
+      if (fd < 0) error::raise("write_buffer::journal", errno);
+      for (const auto& e : snapshot) journal_write(fd, e.first, e.second ? std::optional<std::string_view>(*e.second) : std::nullopt);
+      if (::fsync(fd) != 0) error::raise("write_buffer::journal", errno);
+    } catch (...) {
+      if (fd >= 0) ::close(fd);
+      std::unique_lock<std::shared_mutex> lock{_mutex};
+      _rewriting.reset();
+      throw;
+    }
+
+    std::unique_lock<std::shared_mutex> lock{_mutex};
+    try {
+      for (const auto& e : *_rewriting) journal_write(fd, e.first, e.second ? std::optional<std::string_view>(*e.second) : std::nullopt);
+      if (!_rewriting->empty() && ::fsync(fd) != 0) error::raise("write_buffer::journal", errno);
+      if (::rename(tmp.c_str(), _journal.c_str()) != 0) error::raise("write_buffer::journal", errno);
+    } catch (...) {
+      ::close(fd);
+      _rewriting.reset();
+      throw;
+    }
+    _rewriting.reset();
+    if (_fd >= 0) ::close(_fd);
+    _fd = fd;
+    // Writes are only durable in the new journal once the rename is
+    journal_sync_dir(_journal);
+#endif
+  }
+
+public:
+  /**
+   * Constructor.
+   *
+   * @param env the environment handle
+   * @param dbi the database handle
+   * @param flush_bytes if not zero, `put()` and `del()` call `flush()` once this many bytes are buffered
+   * @param journal if not empty, path of a journal file; existing records in it are replayed into the buffer
+   * @param sync if true, the journal is synced to disk on every write
+   * @throws lmdb::error on failure
+   * @note Journals are only supported on POSIX systems.
+   */
+  write_buffer(MDB_env* const env,
+               const MDB_dbi dbi,
+               const std::size_t flush_bytes = 0,
+               std::string journal = {},
+               const bool sync = false)
+    : _env{env}, _dbi{dbi}, _flush_bytes{flush_bytes}, _journal{std::move(journal)}, _sync{sync} {
+#ifndef _WIN32
+    if (!_journal.empty()) {
+      journal_replay(_journal, *_active);
+      for (const auto& e : *_active) _bytes += e.first.size() + (e.second ? e.second->size() : 0);
+      journal_rewrite();
+    }
+#else
+    if (!_journal.empty()) error::raise("write_buffer", EINVAL);
+#endif
+  }
+
+  write_buffer(const write_buffer&) = delete;
+  write_buffer& operator=(const write_buffer&) = delete;
+
+  /**
+   * Destructor. Buffered writes that weren't flushed are lost, unless journaled.
+   */
+  ~write_buffer() noexcept {
+#ifndef _WIN32
+    if (_fd >= 0) ::close(_fd);
+#endif
+  }
+
+  /**
+   * Buffers a key/value pair to store.
+   *
+   * @throws lmdb::error on failure
+   */
+  void put(const std::string_view key,
+           const std::string_view val) {
+    store(key, val);
+  }
+
+  /**
+   * Buffers a key to delete.
+   *
+   * @throws lmdb::error on failure
+   */
+  void del(const std::string_view key) {
+    store(key, std::nullopt);
+  }
+
+  /**
+   * Retrieves the value of a key, from the buffer or else from the database.
+   *
+   * @param txn a transaction handle
+   * @param key
+   * @param val receives a copy of the value
+   * @throws lmdb::error on failure
+   */
+  bool get(MDB_txn* const txn,
+           const std::string_view key,
+           std::string& val) const {
+    {
+      std::shared_lock<std::shared_mutex> lock{_mutex};
+      for (const table* tab : {_active.get(), _flushing.get()}) {
+        if (!tab) continue;
+        const auto it = tab->find(key);
+        if (it == tab->end()) continue;
+        if (!it->second) return false;
+        val = *it->second;
+        return true;
+      }
+    }
+    std::string_view v;
+    if (!dbi{_dbi}.get(txn, key, v)) return false;
+    val = v;
+    return true;
+  }
+
+  /**
+   * Returns the number of buffered bytes (keys and values) not yet flushed.
+   */
+  std::size_t bytes() const {
+    std::shared_lock<std::shared_mutex> lock{_mutex};
+    return _bytes;
+  }
+
+  /**
+   * Returns the number of buffered keys not yet flushed.
+   */
+  std::size_t size() const {
+    std::shared_lock<std::shared_mutex> lock{_mutex};
+    return _active->size();
+  }
+
+  /**
+   * Writes all buffered operations to the database in one write transaction,
+   * in key order. Writes made during the flush are buffered for the next one.
+   *
+   * @throws lmdb::error on failure, in which case the operations stay buffered
+   * @note Must not be called by a thread that holds a write transaction on the environment.
+   */
+  void flush() {
+    std::lock_guard<std::mutex> guard{_flush_mutex};
+    std::shared_ptr<table> tab;
+    {
+      std::unique_lock<std::shared_mutex> lock{_mutex};
+      if (_active->empty()) return;
+      tab = _active;
+      _flushing = tab;
+      _active = std::make_shared<table>();
+      _bytes = 0;
+    }
+
+    try {
+      auto t = txn::begin(_env);
+      dbi d{_dbi};
+      for (const auto& e : *tab) {
+        if (e.second) d.put(t, e.first, *e.second);
+        else d.del(t, e.first);
+      }
+      t.commit();
+    } catch (...) {
+      // Put the operations back, behind any made since.
+      std::unique_lock<std::shared_mutex> lock{_mutex};
+      for (auto& e : *tab) {
+        if (_active->emplace(e.first, e.second).second) _bytes += e.first.size() + (e.second ? e.second->size() : 0);
+      }
+      _flushing.reset();
+      throw;
+    }
+
+    {
+      std::unique_lock<std::shared_mutex> lock{_mutex};
+      _flushing.reset();
+    }
+    journal_rewrite();
+  }
+
+  /**
+   * Opens a cursor that iterates the buffer merged with the database.
+   *
+   * @param txn a transaction handle
+   * @throws lmdb::error on failure
+   */
+  cursor open_cursor(MDB_txn* txn) const;
+};
+
+/**
+ * A cursor over a `write_buffer` merged with its database, in key order.
+ * Buffered values override those in the database, and buffered deletes hide them.
+ *
+ * The cursor sees the buffer's contents as of each step, and the database as of
+ * the transaction it was opened with.
+ *
+ * @note Supports `MDB_FIRST`, `MDB_NEXT`, `MDB_SET_RANGE` and `MDB_GET_CURRENT`.
+ * @note Returned views remain valid until the next call on the cursor.
+ * @note Instances of this class are movable, but not copyable.
+ */
+class lmdb::write_buffer::cursor {
+protected:
+  struct source {
+    std::shared_ptr<table> tab;
+    table::const_iterator it;
+    std::string key;
+    std::optional<std::string> val;
+    bool valid{false};
+  };
+
+  const write_buffer* _buffer;
+  lmdb::cursor _db;
+  std::string_view _db_key, _db_val;
+  bool _db_valid{false};
+  source _sources[2]; // active, flushing
+  std::string _current;
+  bool _positioned{false};
+
+  void load(source& s) {
+    s.valid = s.it != s.tab->end();
+    if (s.valid) {
+      s.key = s.it->first;
+      s.val = s.it->second;
+    }
+  }
+
+  void seek(const std::string_view* const key) {
+    {
+      std::shared_lock<std::shared_mutex> lock{_buffer->_mutex};
+      _sources[0].tab = _buffer->_active;
+      _sources[1].tab = _buffer->_flushing ? _buffer->_flushing : std::make_shared<table>();
+      for (auto& s : _sources) {
+        s.it = key ? s.tab->lower_bound(*key) : s.tab->begin();
+        load(s);
+      }
+    }
+    _db_key = key ? *key : std::string_view{};
+    _db_valid = _db.get(_db_key, _db_val, key ? MDB_SET_RANGE : MDB_FIRST);
+  }
+
+  /* Advances every source positioned at `key`. */
+  void skip(const std::string_view key) {
+    {
+      std::shared_lock<std::shared_mutex> lock{_buffer->_mutex};
+      for (auto& s : _sources) {
+        if (s.valid && s.key == key) {
+          ++s.it;
+          load(s);
+        }
+      }
+    }
+    if (_db_valid && _db_key == key) _db_valid = _db.get(_db_key, _db_val, MDB_NEXT);
+  }
+
+  /* Finds the smallest key, skipping deleted ones. The buffer wins over the database. */
+  bool settle(std::string_view& key,
+              std::string_view& val) {
+    for (;;) {
+      std::optional<std::string_view> min;
+      for (const auto& s : _sources) {
+        if (s.valid && (!min || s.key < *min)) min = s.key;
+      }
+      if (_db_valid && (!min || _db_key < *min)) min = _db_key;
+      if (!min) return _positioned = false;
+
+      const source* winner{nullptr};
+      for (const auto& s : _sources) {
+        if (s.valid && s.key == *min) {
+          winner = &s;
+          break;
+        }
+      }
+
+      if (!winner) {
+        _current = _db_key;
+        key = _db_key;
+        val = _db_val;
+        return _positioned = true;
+      }
+      if (winner->val) {
+        _current = winner->key;
+        key = winner->key;
+        val = *winner->val;
+        return _positioned = true;
+      }
+
+      const std::string deleted{*min};
+      skip(deleted);
+    }
+  }
+
+public:
+  cursor(const write_buffer& buffer,
+         MDB_txn* const txn)
+    : _buffer{&buffer}, _db{lmdb::cursor::open(txn, buffer._dbi)} {}
+
+  /**
+   * Positions the cursor and retrieves the key/value pair there.
+   *
+   * @param key the key to search for with `MDB_SET_RANGE`, and the key found
+   * @param val the value found
+   * @param op one of `MDB_FIRST`, `MDB_NEXT`, `MDB_SET_RANGE` or `MDB_GET_CURRENT`
+   * @throws lmdb::error on failure
+   */
+  bool get(std::string_view& key,
+           std::string_view& val,
+           const MDB_cursor_op op) {
+    switch (op) {
+      case MDB_FIRST:
+        seek(nullptr);
+        break;
+      case MDB_SET_RANGE: {
+        const std::string target{key};
+        const std::string_view t{target};
+        seek(&t);
+        break;
+      }
+      case MDB_NEXT: {
+        if (!_positioned) return false;
+        const std::string current{_current};
+        skip(current);
+        break;
+      }
+      case MDB_GET_CURRENT:
+        if (!_positioned) return false;
+        break;
+      default:
+        error::raise("write_buffer::cursor::get", EINVAL);
+    }
+    return settle(key, val);
+  }
+};
+
+inline lmdb::write_buffer::cursor
+lmdb::write_buffer::open_cursor(MDB_txn* const txn) const {
+  return cursor{*this, txn};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Posting Lists */
+
+namespace lmdb {
+  class posting_list;
+}
+
+/**
+ * Iterator over the duplicate values of one key in an `MDB_DUPSORT` database,
+ * such as the document IDs of a term in an inverted index, with forward seeks.
+ *
+ * For `MDB_DUPFIXED` databases, values are read a page at a time with
+ * `MDB_GET_MULTIPLE` / `MDB_NEXT_MULTIPLE`. Seeks first gallop within the current
+ * page, and only descend the tree with `MDB_GET_BOTH_RANGE` when the target
+ * lies beyond it. Other `MDB_DUPSORT` databases are read one value at a time.
+ *
+ * @note Values are ordered, and compared, with the database's duplicate comparator.
+ * @note Instances of this class are movable, but not copyable.
+ */
+class lmdb::posting_list {
+protected:
+  MDB_txn* _txn;
+  MDB_dbi _dbi;
+  lmdb::cursor _cursor;
+  std::string _key;
+  bool _fixed;
+  std::string_view _block;
+  std::size_t _width{0};
+  std::size_t _idx{0};
+  bool _valid{false};
+
+  std::size_t block_size() const noexcept {
+    // Without MDB_DUPFIXED, a block is the one current value, which may be empty
+    return _fixed ? _block.size() / _width : 1;
+  }
+
+  std::string_view item(const std::size_t i) const noexcept {
+    return _block.substr(i * _width, _width);
+  }
+
+  int compare(const std::string_view a,
+              const std::string_view b) const noexcept {
+    const MDB_val av{a.size(), const_cast<char*>(a.data())};
+    const MDB_val bv{b.size(), const_cast<char*>(b.data())};
+    return lmdb::dbi_dcmp(_txn, _dbi, &av, &bv);
+  }
+
+  /* First index in [lo, hi) of the current block whose item is >= target, or hi. */
+  std::size_t lower_bound(std::size_t lo,
+                          std::size_t hi,
+                          const std::string_view target) const noexcept {
+    while (lo < hi) {
+      const std::size_t mid = lo + (hi - lo) / 2;
+      if (compare(item(mid), target) < 0) lo = mid + 1;
+      else hi = mid;
+    }
+    return lo;
+  }
+
+  /* Loads the block around the value the cursor is positioned at. */
+  bool load(const MDB_val& current) {
+    _valid = true;
+    _idx = 0;
+    if (!_fixed) {
+      _block = std::string_view(static_cast<const char*>(current.mv_data), current.mv_size);
+      _width = current.mv_size;
+      return true;
+    }
+
+    MDB_val k{_key.size(), const_cast<char*>(_key.data())};
+    MDB_val v{0, nullptr};
+    if (!lmdb::cursor_get(_cursor, &k, &v, MDB_GET_MULTIPLE) || v.mv_size == 0) {
+      // A key with a single value has no sub-database to read pages from
+      v = current;
+    }
+    _block = std::string_view(static_cast<const char*>(v.mv_data), v.mv_size);
+    _width = current.mv_size;
+    if (!_width || _block.size() % _width) error::raise("posting_list", MDB_BAD_VALSIZE);
+    _idx = lower_bound(0, block_size(), std::string_view(static_cast<const char*>(current.mv_data), current.mv_size));
+    return true;
+  }
+
+public:
+  /**
+   * Positions a new iterator at the first value of a key.
+   *
+   * @param txn a transaction handle
+   * @param dbi an `MDB_DUPSORT` database handle
+   * @param key
+   * @throws lmdb::error on failure
+   */
+  static posting_list open(MDB_txn* const txn,
+                           const MDB_dbi dbi,
+                           const std::string_view key) {
+    posting_list result{txn, dbi, key};
+    MDB_val k{result._key.size(), const_cast<char*>(result._key.data())};
+    MDB_val v;
+    if (lmdb::cursor_get(result._cursor, &k, &v, MDB_SET_KEY)) result.load(v);
+    return result;
+  }
+
+  posting_list(MDB_txn* const txn,
+               const MDB_dbi dbi,
+               const std::string_view key)
+    : _txn{txn}, _dbi{dbi}, _cursor{lmdb::cursor::open(txn, dbi)}, _key{key} {
+    unsigned int flags{};
+    lmdb::dbi_flags(txn, dbi, &flags);
+    if (!(flags & MDB_DUPSORT)) error::raise("posting_list", MDB_INCOMPATIBLE);
+    _fixed = flags & MDB_DUPFIXED;
+  }
+
+  /**
+   * Returns true unless the iterator is past the last value.
+   */
+  bool valid() const noexcept {
+    return _valid;
+  }
+
+  /**
+   * Returns the current value.
+   */
+  std::string_view value() const noexcept {
+    return item(_idx);
+  }
+
+  /**
+   * Returns the number of values of the key.
+   *
+   * @throws lmdb::error on failure
+   */
+  std::size_t count() const {
+    if (!_valid) return 0;
+    std::size_t n;
+    lmdb::cursor_count(_cursor, n);
+    return n;
+  }
+
+  /**
+   * Advances to the next value.
+   *
+   * @throws lmdb::error on failure
+   */
+  bool next() {
+    if (!_valid) return false;
+    if (++_idx < block_size()) return true;
+
+    MDB_val k{_key.size(), const_cast<char*>(_key.data())};
+    MDB_val v;
+    if (!lmdb::cursor_get(_cursor, &k, &v, _fixed ? MDB_NEXT_MULTIPLE : MDB_NEXT_DUP)) return _valid = false;
+    if (_fixed) {
+      _block = std::string_view(static_cast<const char*>(v.mv_data), v.mv_size);
+      _idx = 0;
+      return true;
+    }
+    return load(v);
+  }
+
+  /**
+   * Advances to the first value that is not less than `target`. Never moves backwards.
+   *
+   * @throws lmdb::error on failure
+   */
+  bool seek(const std::string_view target) {
+    if (!_valid) return false;
+    if (compare(value(), target) >= 0) return true;
+
+    const std::size_t n = block_size();
+    if (_fixed && compare(item(n - 1), target) >= 0) {
+      // Gallop from the current position, then binary search the last step
+      std::size_t lo = _idx, step = 1;
+      while (lo + step < n && compare(item(lo + step), target) < 0) {
+        lo += step;
+        step *= 2;
+      }
+      _idx = lower_bound(lo + 1, std::min(lo + step, n - 1) + 1, target);
+      return true;
+    }
+
+    MDB_val k{_key.size(), const_cast<char*>(_key.data())};
+    MDB_val v{target.size(), const_cast<char*>(target.data())};
+    if (!lmdb::cursor_get(_cursor, &k, &v, MDB_GET_BOTH_RANGE)) return _valid = false;
+    return load(v);
+  }
+
+  /**
+   * Calls `fn(value)` for each value present under all of `keys`, in order,
+   * by leapfrogging the lists (the shortest list drives the others' seeks).
+   *
+   * @param txn a transaction handle
+   * @param dbi an `MDB_DUPSORT` database handle
+   * @param keys
+   * @param fn called with each common value
+   * @throws lmdb::error on failure
+   */
+  template<typename F>
+  static void intersect(MDB_txn* const txn,
+                        const MDB_dbi dbi,
+                        const std::vector<std::string_view>& keys,
+                        F&& fn) {
+    if (keys.empty()) return;
+    std::vector<posting_list> lists;
+    std::vector<std::size_t> counts;
+    for (const auto& key : keys) {
+      lists.push_back(open(txn, dbi, key));
+      if (!lists.back().valid()) return;
+      counts.push_back(lists.back().count());
+    }
+    std::vector<std::size_t> order(lists.size());
+    for (std::size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&counts](std::size_t a, std::size_t b) { return counts[a] < counts[b]; });
+
+    const std::size_t k = lists.size();
+    std::string_view candidate = lists[order[0]].value();
+    std::size_t matched = 1;
+    for (std::size_t i = 1;; i++) {
+      posting_list& l = lists[order[i % k]];
+      if (matched == k) {
+        fn(candidate);
+        if (!l.next()) return;
+        candidate = l.value();
+        matched = 1;
+        continue;
+      }
+      if (!l.seek(candidate)) return;
+      if (l.compare(l.value(), candidate) == 0) {
+        matched++;
+      } else {
+        candidate = l.value();
+        matched = 1;
+      }
+    }
+  }
+
+  /**
+   * Calls `fn(value)` for each value present under any of `keys`, in order and
+   * without repetition, by merging the lists.
+   *
+   * @param txn a transaction handle
+   * @param dbi an `MDB_DUPSORT` database handle
+   * @param keys
+   * @param fn called with each value
+   * @throws lmdb::error on failure
+   */
+  template<typename F>
+  static void unite(MDB_txn* const txn,
+                    const MDB_dbi dbi,
+                    const std::vector<std::string_view>& keys,
+                    F&& fn) {
+    std::vector<posting_list> lists;
+    for (const auto& key : keys) {
+      lists.push_back(open(txn, dbi, key));
+      if (!lists.back().valid()) lists.pop_back();
+    }
+    while (!lists.empty()) {
+      std::string_view min = lists[0].value();
+      for (const auto& l : lists) {
+        if (l.compare(l.value(), min) < 0) min = l.value();
+      }
+      fn(min);
+      const std::string current{min};
+      for (std::size_t i = 0; i < lists.size();) {
+        if (lists[i].compare(lists[i].value(), current) == 0 && !lists[i].next()) {
+          lists.erase(lists.begin() + i);
+        } else {
+          i++;
+        }
+      }
+    }
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Dump and Load */
+
+namespace lmdb {
+  struct dump_options;
+}
+
+/**
+ * Options for `lmdb::export_dump()` and `lmdb::import_dump()`.
+ */
+struct lmdb::dump_options {
+  /** Worker threads, or 0 for one per CPU. */
+  unsigned int threads = 0;
+  /** Uncompressed size of a data block. */
+  std::size_t block_bytes = 1 << 20;
+  /** Export: approximate size of the key ranges scanned in parallel. */
+  std::size_t range_bytes = 64 << 20;
+  /** Import: commit after this many bytes of data. */
+  std::size_t commit_bytes = 256 << 20;
+  /** Import: write with `MDB_APPEND` (the databases must be empty). */
+  bool append = true;
+  /** Largest uncompressed or stored payload of a block. Export refuses larger blocks
+   *  (`MDB_BAD_VALSIZE`), and import treats them as corruption, so that a damaged
+   *  header can't make it allocate without bound. */
+  std::size_t max_block_bytes = std::size_t(1) << 30;
+  /** If set, compresses the payload of each data block. */
+  std::function<std::string(std::string_view raw)> compress;
+  /** Reverses `compress`. Required to import a compressed dump. */
+  std::function<std::string(std::string_view stored, std::size_t raw_size)> decompress;
+};
+
+/*
+ * Binary dump format. A dump is the 8-byte magic "LMDBXXD1" followed by blocks,
+ * each with a 24-byte header:
+ *
+ *   u8 type, u8 flags, u16 reserved (0), u32 CRC-32, u64 uncompressed payload size,
+ *   u64 stored payload size
+ *
+ * followed by the stored payload. The CRC-32 covers the other header fields and the payload.
+ *
+ * All integers are little-endian. For each database there is a 'B' block (u32
+ * database flags, then the name, empty for the main database), 'D' blocks of
+ * records (u32 key size, u32 value size, key, value) in key order, and an 'E'
+ * block (u64 record count). A 'Z' block ends the dump.
+ */
+namespace lmdb::internal::dump {
+  static constexpr char magic[] = "LMDBXXD1";
+  static constexpr std::size_t header_size = 24;
+  static constexpr std::uint8_t compressed = 0x01;
+  static constexpr unsigned int persistent_flags = MDB_REVERSEKEY | MDB_DUPSORT | MDB_INTEGERKEY |
+                                                   MDB_DUPFIXED | MDB_INTEGERDUP | MDB_REVERSEDUP;
+
+  static inline std::uint32_t crc32(const std::string_view data,
+                                    const std::uint32_t prev = 0) noexcept {
+    static const auto table = [] {
+      std::array<std::uint32_t, 256> t{};
+      for (std::uint32_t i = 0; i < 256; i++) {
+        std::uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+        t[i] = c;
+      }
+      return t;
+    }();
+    std::uint32_t crc = prev ^ 0xFFFFFFFFU;
+    for (const char c : data) crc = table[(crc ^ static_cast<unsigned char>(c)) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFU;
+  }
+
+  template<typename T>
+  static inline void put(std::string& out, T v) {
+    for (std::size_t i = 0; i < sizeof(T); i++) {
+      out.push_back(static_cast<char>(v & 0xFF));
+      v = static_cast<T>(v >> 8);
+    }
+  }
+
+  template<typename T>
+  static inline T get(const char* const p) noexcept {
+    T v = 0;
+    for (std::size_t i = sizeof(T); i > 0; i--) v = static_cast<T>((v << 8) | static_cast<unsigned char>(p[i - 1]));
+    return v;
+  }
+
+  /* CRC-32 of a block: its header (but the CRC field) and its stored payload. */
+  static inline std::uint32_t checksum(const char* const header,
+                                       const std::string_view stored) noexcept {
+    std::uint32_t crc = crc32(std::string_view(header, 4));
+    crc = crc32(std::string_view(header + 8, header_size - 8), crc);
+    return crc32(stored, crc);
+  }
+
+  /* Returns a complete block: header and (possibly compressed) payload. */
+  static inline std::string frame(const char type,
+                                  const std::string_view raw,
+                                  const dump_options& options) {
+    std::string stored;
+    std::uint8_t flags = 0;
+    if (type == 'D' && options.compress) {
+      stored = options.compress(raw);
+      flags |= compressed;
+    } else {
+      stored = raw;
+    }
+    if (raw.size() > options.max_block_bytes || stored.size() > options.max_block_bytes) error::raise("export_dump", MDB_BAD_VALSIZE);
+    std::string block;
+    block.reserve(header_size + stored.size());
+    block.push_back(type);
+    block.push_back(static_cast<char>(flags));
+    put<std::uint16_t>(block, 0);
+    put<std::uint32_t>(block, 0);
+    put<std::uint64_t>(block, raw.size());
+    put<std::uint64_t>(block, stored.size());
+    const std::uint32_t crc = checksum(block.data(), stored);
+    for (std::size_t i = 0; i < 4; i++) block[4 + i] = static_cast<char>((crc >> (8 * i)) & 0xFF);
+    block += stored;
+    return block;
+  }
+
+  /* Encodes the records with keys in [lo, hi) into data blocks, passing each to `emit`. */
+  template<typename Emit>
+  static std::size_t scan(MDB_txn* const txn,
+                          const MDB_dbi dbi,
+                          const std::string& lo,
+                          const std::string& hi,
+                          const std::vector<std::string>* const skip,
+                          const dump_options& options,
+                          Emit&& emit) {
+    std::size_t count = 0;
+    std::string raw;
+    const MDB_val hiV{hi.size(), const_cast<char*>(hi.data())};
+    auto cursor = lmdb::cursor::open(txn, dbi);
+    std::string_view key{lo}, val;
+    for (bool found = cursor.get(key, val, lo.empty() ? MDB_FIRST : MDB_SET_RANGE); found; found = cursor.get(key, val, MDB_NEXT)) {
+      const MDB_val keyV{key.size(), const_cast<char*>(key.data())};
+      if (!hi.empty() && lmdb::dbi_cmp(txn, dbi, &keyV, &hiV) >= 0) break;
+      if (skip && std::binary_search(skip->begin(), skip->end(), key)) continue;
+      put<std::uint32_t>(raw, static_cast<std::uint32_t>(key.size()));
+      put<std::uint32_t>(raw, static_cast<std::uint32_t>(val.size()));
+      raw += key;
+      raw += val;
+      count++;
+      if (raw.size() >= options.block_bytes) {
+        emit(frame('D', raw, options));
+        raw.clear();
+      }
+    }
+    if (!raw.empty()) emit(frame('D', raw, options));
+    return count;
+  }
+}
+
+namespace lmdb {
+  /**
+   * Exports databases to a binary dump, in parallel. Each database is split into
+   * key ranges (see `dbi::split_points()`), which are scanned and encoded by worker
+   * threads, each in its own read-only transaction, and written out in order.
+   * The whole dump reads one snapshot: a range whose worker began after a write was
+   * committed is scanned again by the calling thread in the export's own transaction.
+   *
+   * @param env the environment handle
+   * @param sink called with consecutive chunks of the dump
+   * @param names databases to export ("" for the main database), or empty for all of
+   *              them. When the main database is exported, records that name other
+   *              databases are left out.
+   * @param options
+   * @returns the number of records exported
+   * @throws lmdb::error on failure
+   */
+  static inline std::size_t
+  export_dump(MDB_env* const env,
+              const std::function<void(std::string_view)>& sink,
+              std::vector<std::string> names = {},
+              const dump_options& options = {}) {
+    namespace d = internal::dump;
+    const unsigned int threads = options.threads ? options.threads : std::max(1U, std::thread::hardware_concurrency());
+
+    // Open all handles up front, and share them with the environment
+    std::vector<std::string> named;
+    std::vector<MDB_dbi> handles;
+    {
+      auto t = txn::begin(env, nullptr, MDB_RDONLY);
+      named = dbi::names(t);
+      if (names.empty()) {
+        names.push_back("");
+        names.insert(names.end(), named.begin(), named.end());
+      }
+      for (const auto& name : names) handles.push_back(dbi::open(t, name.empty() ? nullptr : name.c_str()).handle());
+      t.commit();
+    }
+    std::sort(named.begin(), named.end());
+
+    auto t = txn::begin(env, nullptr, MDB_RDONLY);
+    const std::size_t snapshot = internal::txn_id(t);
+
+    sink(std::string_view(d::magic, 8));
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < names.size(); i++) {
+      const dbi handle{handles[i]};
+      const std::vector<std::string>* const skip = names[i].empty() ? &named : nullptr;
+      std::string header;
+      d::put<std::uint32_t>(header, handle.flags(t) & d::persistent_flags);
+      header += names[i];
+      sink(d::frame('B', header, options));
+
+      std::vector<std::string> bounds;
+      if (threads > 1) {
+        const MDB_stat st = handle.stat(t);
+        const std::size_t bytes = (st.ms_branch_pages + st.ms_leaf_pages + st.ms_overflow_pages) * st.ms_psize;
+        bounds = handle.split_points(t, std::max<std::size_t>(threads, bytes / std::max<std::size_t>(options.range_bytes, 1)));
+      }
+
+      std::size_t count = 0;
+      if (bounds.empty()) {
+        count = d::scan(t, handle, {}, {}, skip, options, [&](std::string&& block) { sink(block); });
+      } else {
+        struct result {
+          bool current = false;
+          std::vector<std::string> blocks;
+          std::size_t count = 0;
+        };
+        struct range {
+          std::string lo, hi;
+          std::future<result> work;
+        };
+        std::deque<range> pending;
+        bool stale = false;
+        const auto drain = [&] {
+          range& front = pending.front();
+          result r = front.work.valid() ? front.work.get() : result{};
+          if (r.current) {
+            for (const auto& block : r.blocks) sink(block);
+            count += r.count;
+          } else {
+            // The worker saw a later snapshot: scan the range in ours, and stop spawning workers
+            stale = true;
+            count += d::scan(t, handle, front.lo, front.hi, skip, options, [&](std::string&& block) { sink(block); });
+          }
+          pending.pop_front();
+        };
+        for (std::size_t r = 0; r <= bounds.size(); r++) {
+          range next{r ? bounds[r - 1] : std::string(), r < bounds.size() ? bounds[r] : std::string(), {}};
+          if (!stale) {
+            next.work = std::async(std::launch::async, [env, handle = handles[i], lo = next.lo, hi = next.hi, skip, snapshot, &options] {
+              auto wt = txn::begin(env, nullptr, MDB_RDONLY);
+              result out;
+              if (internal::txn_id(wt) != snapshot) return out;
+              out.current = true;
+              out.count = d::scan(wt, handle, lo, hi, skip, options, [&](std::string&& block) { out.blocks.push_back(std::move(block)); });
+              return out;
+            });
+          }
+          pending.push_back(std::move(next));
+          if (pending.size() >= threads) drain();
+        }
+        while (!pending.empty()) drain();
+      }
+
+      std::string footer;
+      d::put<std::uint64_t>(footer, count);
+      sink(d::frame('E', footer, options));
+      total += count;
+    }
+    sink(d::frame('Z', {}, options));
+    return total;
+  }
+
+  /**
+   * Imports a binary dump made by `export_dump()`. Blocks are checksummed and
+   * decompressed by worker threads, and written in order by the calling thread,
+   * committing every `options.commit_bytes`. Databases are created as needed, with
+   * the flags they were exported with.
+   *
+   * @param env the environment handle
+   * @param source called as `source(buffer, size)` to read up to `size` bytes of the dump; returns 0 at the end
+   * @param options
+   * @returns the number of records imported
+   * @throws lmdb::error on failure, or `MDB_CORRUPTED` if the dump is malformed
+   * @note Databases with custom comparators must be opened (and have their comparators
+   *       set) in the environment before importing.
+   */
+  static inline std::size_t
+  import_dump(MDB_env* const env,
+              const std::function<std::size_t(char*, std::size_t)>& source,
+              const dump_options& options = {}) {
+    namespace d = internal::dump;
+    const unsigned int threads = options.threads ? options.threads : std::max(1U, std::thread::hardware_concurrency());
+
+    const auto read = [&](char* const buf, const std::size_t n) {
+      std::size_t off = 0;
+      while (off < n) {
+        const std::size_t got = source(buf + off, n - off);
+        if (got == 0) error::raise("import_dump", MDB_CORRUPTED);
+        off += got;
+      }
+    };
+
+    char magic[8];
+    read(magic, sizeof(magic));
+    if (std::memcmp(magic, d::magic, sizeof(magic)) != 0) error::raise("import_dump", MDB_CORRUPTED);
+
+    struct block {
+      char type;
+      std::string payload;
+    };
+
+    txn t{nullptr};
+    cursor c{nullptr};
+    MDB_dbi handle{};
+    unsigned int flags{};
+    std::string prev;
+    std::size_t count = 0, total = 0, bytes = 0;
+    bool done = false;
+
+    const auto apply = [&](const block& b) {
+      const std::string& p = b.payload;
+      switch (b.type) {
+        case 'B': {
+          if (p.size() < 4) error::raise("import_dump", MDB_CORRUPTED);
+          if (!t) t = txn::begin(env);
+          const std::string name = p.substr(4);
+          flags = d::get<std::uint32_t>(p.data()) & d::persistent_flags;
+          handle = dbi::open(t, name.empty() ? nullptr : name.c_str(), flags | MDB_CREATE).handle();
+          c = cursor::open(t, handle);
+          prev.clear();
+          count = 0;
+          break;
+        }
+        case 'D':
+          if (!c) error::raise("import_dump", MDB_CORRUPTED);
+          for (std::size_t off = 0; off < p.size();) {
+            if (p.size() - off < 8) error::raise("import_dump", MDB_CORRUPTED);
+            const std::size_t klen = d::get<std::uint32_t>(p.data() + off), vlen = d::get<std::uint32_t>(p.data() + off + 4);
+            if (p.size() - off - 8 < klen + vlen) error::raise("import_dump", MDB_CORRUPTED);
+            const std::string_view key(p.data() + off + 8, klen), val(p.data() + off + 8 + klen, vlen);
+            unsigned int put_flags = 0;
+            if (options.append) {
+              put_flags = ((flags & MDB_DUPSORT) && key == prev) ? MDB_APPENDDUP : MDB_APPEND;
+              if (flags & MDB_DUPSORT) prev = key;
+            }
+            if (!c.put(key, val, put_flags)) error::raise("import_dump", MDB_KEYEXIST);
+            off += 8 + klen + vlen;
+            count++;
+          }
+          bytes += p.size();
+          if (bytes >= options.commit_bytes) {
+            c.close();
+            t.commit();
+            t = txn::begin(env);
+            c = cursor::open(t, handle);
+            bytes = 0;
+          }
+          break;
+        case 'E':
+          if (!c || p.size() != 8 || d::get<std::uint64_t>(p.data()) != count) error::raise("import_dump", MDB_CORRUPTED);
+          c.close();
+          total += count;
+          break;
+        case 'Z':
+          if (c) error::raise("import_dump", MDB_CORRUPTED);
+          if (t) t.commit();
+          done = true;
+          break;
+        default:
+          error::raise("import_dump", MDB_CORRUPTED);
+      }
+    };
+
+    std::deque<std::future<block>> pending;
+    const auto drain = [&] {
+      const block b = pending.front().get();
+      pending.pop_front();
+      apply(b);
+    };
+
+    try {
+      for (bool last = false; !last;) {
+        char header[d::header_size];
+        read(header, sizeof(header));
+        const char type = header[0];
+        const std::uint8_t bflags = static_cast<std::uint8_t>(header[1]);
+        if (header[2] || header[3]) error::raise("import_dump", MDB_CORRUPTED);
+        const std::uint64_t raw_size = d::get<std::uint64_t>(header + 8);
+        const std::uint64_t stored_size = d::get<std::uint64_t>(header + 16);
+        // The header isn't verified until the payload is read, so bound the allocation first
+        if (raw_size > options.max_block_bytes || stored_size > options.max_block_bytes) error::raise("import_dump", MDB_CORRUPTED);
+        if (!(bflags & d::compressed) && stored_size != raw_size) error::raise("import_dump", MDB_CORRUPTED);
+        std::string stored(stored_size, '\0');
+        read(stored.data(), stored.size());
+        last = type == 'Z';
+
+        pending.push_back(std::async(std::launch::async, [&options, header = std::string(header, sizeof(header)), type, bflags, raw_size, stored = std::move(stored)]() mutable {
+          if (d::checksum(header.data(), stored) != d::get<std::uint32_t>(header.data() + 4)) error::raise("import_dump", MDB_CORRUPTED);
+          if (bflags & d::compressed) {
+            if (!options.decompress) error::raise("import_dump", MDB_INCOMPATIBLE);
+            stored = options.decompress(stored, raw_size);
+          }
+          if (stored.size() != raw_size) error::raise("import_dump", MDB_CORRUPTED);
+          return block{type, std::move(stored)};
+        }));
+        if (pending.size() >= threads) drain();
+      }
+      while (!pending.empty()) drain();
+    } catch (...) {
+      for (auto& f : pending) f.wait();
+      c.close();
+      throw;
+    }
+
+    if (!done) error::raise("import_dump", MDB_CORRUPTED);
+    return total;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Expiry */
+
+namespace lmdb {
+  class ttl_dbi;
+  class ttl_sweeper;
+}
+
+/**
+ * A database whose records may expire. Each value is stored behind an 8-byte
+ * big-endian expiry time (milliseconds since the epoch, or 0 for none), and
+ * records that expire are also indexed in a companion database, keyed by
+ * expiry time and then primary key. Expired records can thus be found and
+ * removed (see `sweep()` and `lmdb::ttl_sweeper`) without scanning the data.
+ *
+ * @note The data database must not be `MDB_DUPSORT`.
+ */
+class lmdb::ttl_dbi {
+public:
+  using clock = std::chrono::system_clock;
+
+protected:
+  MDB_dbi _data{0};
+  MDB_dbi _index{0};
+
+  static constexpr std::size_t header_size = 8;
+
+  static std::uint64_t millis(const clock::time_point t) noexcept {
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t.time_since_epoch()).count();
+    return ms > 0 ? static_cast<std::uint64_t>(ms) : 0;
+  }
+
+  static std::string index_key(const std::uint64_t expires,
+                               const std::string_view key) {
+    std::string result(header_size, '\0');
+    cmp::detail::store<std::uint64_t, true>(result.data(), expires);
+    result += key;
+    return result;
+  }
+
+public:
+  /**
+   * Opens the data database and its expiry index, named `name` with ".ttl"
+   * appended (or "ttl" for the main database).
+   *
+   * @param txn a transaction handle
+   * @param name the database name, or nullptr
+   * @param flags dbi flags, ie MDB_CREATE
+   * @throws lmdb::error on failure
+   */
+  static ttl_dbi open(MDB_txn* const txn,
+                      const char* const name = nullptr,
+                      const unsigned int flags = dbi::default_flags) {
+    const std::string index_name = name ? std::string(name) + ".ttl" : std::string("ttl");
+    ttl_dbi result;
+    result._data = dbi::open(txn, name, flags).handle();
+    result._index = dbi::open(txn, index_name.c_str(), flags & MDB_CREATE).handle();
+    return result;
+  }
+
+  /**
+   * Returns the data database handle. Its values carry the expiry header.
+   */
+  MDB_dbi data() const noexcept {
+    return _data;
+  }
+
+  /**
+   * Returns the expiry index handle.
+   */
+  MDB_dbi index() const noexcept {
+    return _index;
+  }
+
+  /**
+   * Retrieves a value.
+   *
+   * @param txn a transaction handle
+   * @param key
+   * @param val set to the value, without its expiry header
+   * @param filter if true, treats records that have expired (but may not have
+   *        been swept yet) as absent
+   * @returns true if the key was found
+   * @throws lmdb::error on failure
+   */
+  bool get(MDB_txn* const txn,
+           const std::string_view key,
+           std::string_view& val,
+           const bool filter = true) const {
+    clock::time_point expires;
+    return get(txn, key, val, expires) && (!filter || expires == clock::time_point{} || expires > clock::now());
+  }
+
+  /**
+   * Retrieves a value and its expiry time, whether it has expired or not.
+   *
+   * @param expires set to the expiry time, or the epoch if the record doesn't expire
+   * @throws lmdb::error on failure
+   */
+  bool get(MDB_txn* const txn,
+           const std::string_view key,
+           std::string_view& val,
+           clock::time_point& expires) const {
+    std::string_view stored;
+    if (!dbi{_data}.get(txn, key, stored)) return false;
+    if (stored.size() < header_size) error::raise("ttl_dbi::get", MDB_CORRUPTED);
+    expires = clock::time_point{std::chrono::milliseconds(cmp::detail::load<std::uint64_t, true>(stored.data()))};
+    val = stored.substr(header_size);
+    return true;
+  }
+
+  /**
+   * Stores a key/value pair, replacing the expiry time of an existing record.
+   *
+   * @param txn a write transaction handle
+   * @param key
+   * @param val
+   * @param expires when the record expires, or the epoch (the default) for never
+   * @param flags put flags, ie MDB_NOOVERWRITE
+   * @returns false if `MDB_NOOVERWRITE` was given and the key exists
+   * @throws lmdb::error on failure
+   */
+  bool put(MDB_txn* const txn,
+           const std::string_view key,
+           const std::string_view val,
+           const clock::time_point expires = {},
+           const unsigned int flags = dbi::default_put_flags) {
+    std::string_view old;
+    clock::time_point old_expires;
+    if (get(txn, key, old, old_expires)) {
+      if (flags & MDB_NOOVERWRITE) return false;
+      if (old_expires != clock::time_point{}) dbi{_index}.del(txn, index_key(millis(old_expires), key));
+    }
+
+    std::string stored(header_size, '\0');
+    cmp::detail::store<std::uint64_t, true>(stored.data(), millis(expires));
+    stored += val;
+    dbi{_data}.put(txn, key, stored, flags);
+    if (millis(expires)) dbi{_index}.put(txn, index_key(millis(expires), key), std::string_view{});
+    return true;
+  }
+
+  /**
+   * Stores a key/value pair that expires after `ttl`.
+   *
+   * @throws lmdb::error on failure
+   */
+  bool put(MDB_txn* const txn,
+           const std::string_view key,
+           const std::string_view val,
+           const clock::duration ttl,
+           const unsigned int flags = dbi::default_put_flags) {
+    return put(txn, key, val, clock::now() + ttl, flags);
+  }
+
+  /**
+   * Removes a key and its expiry index entry.
+   *
+   * @returns true if the key was found
+   * @throws lmdb::error on failure
+   */
+  bool del(MDB_txn* const txn,
+           const std::string_view key) {
+    std::string_view old;
+    clock::time_point old_expires;
+    if (!get(txn, key, old, old_expires)) return false;
+    if (old_expires != clock::time_point{}) dbi{_index}.del(txn, index_key(millis(old_expires), key));
+    return dbi{_data}.del(txn, key);
+  }
+
+  /**
+   * Removes up to `limit` records that expired at or before `now`, oldest first.
+   *
+   * @param txn a write transaction handle
+   * @param now
+   * @param limit the most records to remove
+   * @returns the number of records removed
+   * @throws lmdb::error on failure
+   */
+  std::size_t sweep(MDB_txn* const txn,
+                    const clock::time_point now = clock::now(),
+                    const std::size_t limit = SIZE_MAX) {
+    const std::uint64_t cutoff = millis(now);
+    std::size_t result = 0;
+    auto cursor = lmdb::cursor::open(txn, _index);
+    std::string_view key, val;
+    while (result < limit && cursor.get(key, val, MDB_FIRST)) {
+      if (key.size() < header_size) error::raise("ttl_dbi::sweep", MDB_CORRUPTED);
+      if (cmp::detail::load<std::uint64_t, true>(key.data()) > cutoff) break;
+      dbi{_data}.del(txn, key.substr(header_size));
+      cursor.del();
+      result++;
+    }
+    return result;
+  }
+};
+
+/**
+ * Sweeps expired records of a `ttl_dbi` from a background thread. Each pass
+ * removes records in batches of at most `batch` per write transaction, and
+ * pauses between batches so that other writers can take the write lock.
+ */
+class lmdb::ttl_sweeper {
+public:
+  /**
+   * Constructor. Starts the sweeping thread.
+   *
+   * @param env the environment handle
+   * @param dbi the database to sweep
+   * @param batch the most records to remove per write transaction
+   * @param interval time between passes
+   * @param pause time between batches within a pass
+   */
+  ttl_sweeper(MDB_env* const env,
+              const ttl_dbi dbi,
+              const std::size_t batch = 1000,
+              const std::chrono::milliseconds interval = std::chrono::seconds(1),
+              const std::chrono::milliseconds pause = std::chrono::milliseconds(10))
+    : _env{env}, _dbi{dbi}, _batch{std::max<std::size_t>(batch, 1)}, _interval{interval}, _pause{pause} {
+    _thread = std::thread([this] { run(); });
+  }
+
+  ttl_sweeper(const ttl_sweeper&) = delete;
+  ttl_sweeper& operator=(const ttl_sweeper&) = delete;
+
+  /**
+   * Destructor. Stops the sweeping thread.
+   */
+  ~ttl_sweeper() noexcept {
+    stop();
+  }
+
+  /**
+   * Returns the number of records removed so far.
+   */
+  std::size_t swept() const {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _swept;
+  }
+
+  /**
+   * Returns the number of completed passes.
+   */
+  std::size_t passes() const {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _passes;
+  }
+
+  /**
+   * Stops the sweeping thread, waiting for a batch in progress to finish.
+   *
+   * @note this method is idempotent
+   */
+  void stop() noexcept {
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _stopping = true;
+    }
+    _wakeup.notify_all();
+    if (_thread.joinable()) _thread.join();
+  }
+
+protected:
+  MDB_env* _env;
+  ttl_dbi _dbi;
+  std::size_t _batch;
+  std::chrono::milliseconds _interval;
+  std::chrono::milliseconds _pause;
+  mutable std::mutex _mutex;
+  std::condition_variable _wakeup;
+  bool _stopping{false};
+  std::size_t _swept{0};
+  std::size_t _passes{0};
+  std::thread _thread;
+
+  void run() {
+    std::unique_lock<std::mutex> lock{_mutex};
+    while (!_stopping) {
+      const auto now = ttl_dbi::clock::now();
+      while (!_stopping) {
+        lock.unlock();
+        std::size_t n = 0;
+        try {
+          auto txn = lmdb::txn::begin(_env);
+          n = _dbi.sweep(txn, now, _batch);
+          txn.commit();
+        } catch (...) {
+          // A failed batch is abandoned; the next pass retries.
+          n = 0;
+        }
+        lock.lock();
+        _swept += n;
+        if (n < _batch) break;
+        _wakeup.wait_for(lock, _pause, [this] { return _stopping; });
+      }
+      _passes++;
+      _wakeup.wait_for(lock, _interval, [this] { return _stopping; });
+    }
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Blobs */
+
+namespace lmdb {
+  class blob_store;
+}
+
+/**
+ * Stores large values as sequences of fixed-size chunks, so that they don't
+ * need contiguous runs of overflow pages, and can be written and read without
+ * holding the whole value in memory.
+ *
+ * A blob is stored under its key followed by a 4-byte big-endian chunk number.
+ * Chunk 0 is a header holding the blob size (8 bytes) and chunk size (4 bytes),
+ * both big-endian; chunks 1 and up hold the data.
+ */
+class lmdb::blob_store {
+protected:
+  MDB_dbi _dbi{0};
+  std::size_t _chunk_size{0};
+
+  static constexpr std::size_t header_size = 12;
+
+  static std::string chunk_key(const std::string_view key,
+                               const std::uint32_t chunk) {
+    std::string result{key};
+    result.resize(key.size() + 4);
+    cmp::detail::store<std::uint32_t, true>(result.data() + key.size(), chunk);
+    return result;
+  }
+
+public:
+  using source = std::function<std::size_t(char* buffer, std::size_t size)>;
+
+  /**
+   * Opens the database holding the blobs.
+   *
+   * @param txn a transaction handle
+   * @param name the database name, or nullptr
+   * @param flags dbi flags, ie MDB_CREATE
+   * @param chunk_size bytes per chunk, or 0 for the largest chunk that fits in a leaf page
+   * @throws lmdb::error on failure
+   */
+  static blob_store open(MDB_txn* const txn,
+                         const char* const name = nullptr,
+                         const unsigned int flags = dbi::default_flags,
+                         const std::size_t chunk_size = 0) {
+    blob_store result;
+    result._dbi = dbi::open(txn, name, flags).handle();
+    result._chunk_size = chunk_size;
+    return result;
+  }
+
+  /**
+   * Returns the database handle.
+   */
+  MDB_dbi handle() const noexcept {
+    return _dbi;
+  }
+
+  /**
+   * Returns the size of the chunks a blob stored under `key` is split into.
+   * Unless a chunk size was given to `open()`, this is the largest that keeps
+   * chunks on leaf pages, rather than overflow pages.
+   *
+   * @throws lmdb::error on failure
+   */
+  std::size_t chunk_size(MDB_txn* const txn,
+                         const std::string_view key) const {
+    if (_chunk_size) return _chunk_size;
+    MDB_stat st;
+    lmdb::env_stat(lmdb::txn_env(txn), &st);
+    // A leaf node holds an 8-byte header, the key and the value, and two nodes must fit per page
+    const std::size_t node_max = internal::node_max(st.ms_psize);
+    if (node_max < 8 + key.size() + 4 + 2) error::raise("blob_store::chunk_size", MDB_BAD_VALSIZE);
+    return (node_max - 8 - key.size() - 4) & ~std::size_t(1);
+  }
+
+  /**
+   * Returns the size of a blob.
+   *
+   * @param size set to the size in bytes
+   * @returns false if the blob doesn't exist
+   * @throws lmdb::error on failure
+   */
+  bool size(MDB_txn* const txn,
+            const std::string_view key,
+            std::size_t& size) const {
+    std::size_t chunk;
+    return header(txn, key, size, chunk);
+  }
+
+  /**
+   * Writes a blob, replacing any existing one, reading its data from `src`
+   * directly into the map, one chunk at a time.
+   *
+   * @param txn a write transaction handle
+   * @param key
+   * @param src called as `src(buffer, size)` to fill up to `size` bytes; returns 0 at the end
+   * @returns the size of the blob
+   * @throws lmdb::error on failure
+   */
+  std::size_t write(MDB_txn* const txn,
+                    const std::string_view key,
+                    const source& src) {
+    del(txn, key);
+    const std::size_t chunk = chunk_size(txn, key);
+    std::size_t total = 0;
+    std::uint32_t n = 0;
+    for (;;) {
+      // Chunks are read straight into space reserved in the map. Only a final,
+      // shorter chunk is copied, since the reservation can't be shrunk.
+      if (n == UINT32_MAX) error::raise("blob_store::write", MDB_BAD_VALSIZE);
+      const std::string ck = chunk_key(key, ++n);
+      char* const data = dbi{_dbi}.reserve(txn, ck, chunk);
+      std::size_t filled = 0;
+      while (filled < chunk) {
+        const std::size_t got = src(data + filled, chunk - filled);
+        if (!got) break;
+        filled += got;
+      }
+      total += filled;
+      if (filled == chunk) continue;
+      if (filled) dbi{_dbi}.put(txn, ck, std::string(data, filled));
+      else dbi{_dbi}.del(txn, ck);
+      break;
+    }
+
+    char head[header_size];
+    cmp::detail::store<std::uint64_t, true>(head, total);
+    cmp::detail::store<std::uint32_t, true>(head + 8, static_cast<std::uint32_t>(chunk));
+    dbi{_dbi}.put(txn, chunk_key(key, 0), std::string_view(head, header_size));
+    return total;
+  }
+
+  /**
+   * Writes a blob from a value in memory.
+   *
+   * @throws lmdb::error on failure
+   */
+  void put(MDB_txn* const txn,
+           const std::string_view key,
+           std::string_view data) {
+    write(txn, key, [&](char* const buffer, const std::size_t size) {
+      const std::size_t n = std::min(size, data.size());
+      std::memcpy(buffer, data.data(), n);
+      data.remove_prefix(n);
+      return n;
+    });
+  }
+
+  /**
+   * Reads a blob, or part of it, as a sequence of views into the memory map.
+   * The views remain valid until the transaction ends or writes to the database.
+   *
+   * @param txn a transaction handle
+   * @param key
+   * @param fn called with each consecutive piece of the blob
+   * @param offset the first byte to read
+   * @param length the most bytes to read
+   * @returns false if the blob doesn't exist
+   * @throws lmdb::error on failure, or `MDB_CORRUPTED` if chunks are missing
+   */
+  bool read(MDB_txn* const txn,
+            const std::string_view key,
+            const std::function<void(std::string_view)>& fn,
+            const std::size_t offset = 0,
+            const std::size_t length = SIZE_MAX) const {
+    std::size_t size, chunk;
+    if (!header(txn, key, size, chunk)) return false;
+    if (offset >= size || !length) return true;
+    std::size_t remaining = std::min(length, size - offset);
+    std::size_t skip = offset % chunk;
+    std::uint32_t n = static_cast<std::uint32_t>(offset / chunk + 1);
+
+    // Chunks are usually adjacent, but keys that extend this one may sort between them
+    auto cursor = lmdb::cursor::open(txn, _dbi);
+    std::string expected = chunk_key(key, n);
+    std::string_view k{expected}, v;
+    bool found = cursor.get(k, v, MDB_SET_KEY);
+    while (remaining) {
+      if (!found || k != expected) {
+        k = expected;
+        if (!cursor.get(k, v, MDB_SET_KEY)) error::raise("blob_store::read", MDB_CORRUPTED);
+      }
+      if (v.size() <= skip) error::raise("blob_store::read", MDB_CORRUPTED);
+      const std::string_view piece = v.substr(skip, remaining);
+      fn(piece);
+      remaining -= piece.size();
+      skip = 0;
+      cmp::detail::store<std::uint32_t, true>(expected.data() + key.size(), ++n);
+      if (remaining) found = cursor.get(k, v, MDB_NEXT);
+    }
+    return true;
+  }
+
+  /**
+   * Reads a blob, or part of it, into a string.
+   *
+   * @returns false if the blob doesn't exist
+   * @throws lmdb::error on failure
+   */
+  bool get(MDB_txn* const txn,
+           const std::string_view key,
+           std::string& data,
+           const std::size_t offset = 0,
+           const std::size_t length = SIZE_MAX) const {
+    data.clear();
+    return read(txn, key, [&](const std::string_view piece) { data += piece; }, offset, length);
+  }
+
+  /**
+   * Removes a blob.
+   *
+   * @returns false if the blob doesn't exist
+   * @throws lmdb::error on failure
+   */
+  bool del(MDB_txn* const txn,
+           const std::string_view key) {
+    std::size_t size, chunk;
+    if (!header(txn, key, size, chunk)) return false;
+    const std::size_t chunks = (size + chunk - 1) / chunk;
+    for (std::size_t n = 0; n <= chunks; n++) {
+      dbi{_dbi}.del(txn, chunk_key(key, static_cast<std::uint32_t>(n)));
+    }
+    return true;
+  }
+
+protected:
+  bool header(MDB_txn* const txn,
+              const std::string_view key,
+              std::size_t& size,
+              std::size_t& chunk) const {
+    std::string_view v;
+    if (!dbi{_dbi}.get(txn, chunk_key(key, 0), v)) return false;
+    if (v.size() != header_size) error::raise("blob_store", MDB_CORRUPTED);
+    size = static_cast<std::size_t>(cmp::detail::load<std::uint64_t, true>(v.data()));
+    chunk = cmp::detail::load<std::uint32_t, true>(v.data() + 8);
+    if (!chunk) error::raise("blob_store", MDB_CORRUPTED);
+    return true;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Digests */
+
+namespace lmdb {
+  struct digest_options;
+  class digest_tree;
+  class digest_cache;
+}
+
+/**
+ * Options for `digest_tree::compute()`.
+ */
+struct lmdb::digest_options {
+  /** Scan ranges of the database in parallel, each in its own read-only transaction. */
+  unsigned int threads = 1;
+  /** Key prefixes up to this many bytes long get nodes of their own. */
+  std::size_t max_depth = 8;
+  /** Nodes with at most this many entries aren't divided further. */
+  std::size_t leaf_entries = 256;
+};
+
+/**
+ * A hierarchical digest of a database, for finding where two replicas differ
+ * without comparing every record.
+ *
+ * Nodes are keyed by key prefix: the root (the empty prefix) covers every key,
+ * and a node for prefix `p` has a child for each `p + byte` that begins a key.
+ * A node holds the number of entries under it and the sum of their 64-bit
+ * hashes. Sums don't depend on how a range was divided, so trees computed with
+ * different options, or on replicas with different B+tree layouts, can still be
+ * compared node by node.
+ *
+ * Ranges are in byte-wise key order, so the database should use the default comparator.
+ */
+class lmdb::digest_tree {
+public:
+  struct node {
+    std::uint64_t count = 0;
+    std::uint64_t hash = 0;
+
+    bool operator==(const node& other) const noexcept {
+      return count == other.count && hash == other.hash;
+    }
+
+    bool operator!=(const node& other) const noexcept {
+      return !(*this == other);
+    }
+
+    node& operator+=(const node& other) noexcept {
+      count += other.count;
+      hash += other.hash;
+      return *this;
+    }
+
+    node& operator-=(const node& other) noexcept {
+      count -= other.count;
+      hash -= other.hash;
+      return *this;
+    }
+  };
+
+  /** A range of keys `[lo, hi)`. An empty `hi` means the end of the database. */
+  using range = std::pair<std::string, std::string>;
+
+  /**
+   * Returns the hash of one record.
+   */
+  static std::uint64_t hash(const std::string_view key,
+                            const std::string_view val) noexcept {
+    std::uint64_t h = 0xcbf29ce484222325ULL ^ key.size();
+    for (const char c : key) h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+    h = (h ^ 0xFF) * 0x100000001b3ULL;
+    for (const char c : val) h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+    // The splitmix64 finalizer spreads every input bit over the whole word
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+  }
+
+  /**
+   * Computes the digest of a database.
+   *
+   * Parallel scans need a read-only `txn`: each worker opens its own read-only
+   * transaction, which must see the same snapshot. In a write transaction, whose
+   * changes no other transaction can see, the database is scanned by one cursor.
+   *
+   * @param txn a transaction handle
+   * @param dbi a database handle
+   * @param options
+   * @throws lmdb::error on failure, or `MDB_BAD_TXN` if a parallel computation can't
+   *         see the snapshot of `txn` (a write was committed after it began)
+   */
+  static digest_tree compute(MDB_txn* const txn,
+                             const MDB_dbi dbi,
+                             const digest_options& options = {}) {
+    digest_tree result;
+    result._txnid = internal::txn_id(txn);
+
+    const std::size_t threads = std::max(1U, options.threads);
+    const bool parallel = threads > 1 && internal::read_only(txn);
+    const auto bounds = parallel ? lmdb::dbi{dbi}.split_points(txn, threads) : std::vector<std::string>{};
+    const std::size_t ranges = bounds.size() + 1;
+
+    std::vector<std::vector<std::pair<std::string, node>>> parts(ranges);
+    if (ranges == 1) {
+      parts[0] = scan(txn, dbi, {}, {}, options);
+    } else {
+      MDB_env* const env = lmdb::txn_env(txn);
+      std::vector<std::future<std::vector<std::pair<std::string, node>>>> pending;
+      for (std::size_t r = 0; r < ranges; r++) {
+        pending.push_back(std::async(std::launch::async, [&, env, r] {
+          auto t = txn::begin(env, nullptr, MDB_RDONLY);
+          if (internal::txn_id(t) != result._txnid) error::raise("digest_tree::compute", MDB_BAD_TXN);
+          return scan(t, dbi, r ? bounds[r - 1] : std::string(), r < bounds.size() ? bounds[r] : std::string(), options);
+        }));
+      }
+      for (std::size_t r = 0; r < ranges; r++) parts[r] = pending[r].get();
+    }
+
+    // Nodes that straddle range boundaries are summed here, and only then pruned
+    for (auto& part : parts) {
+      for (auto& n : part) result._nodes[std::move(n.first)] += n.second;
+    }
+    result._nodes[std::string()];
+    for (auto it = result._nodes.begin(); it != result._nodes.end(); ++it) {
+      if (it->second.count > options.leaf_entries) continue;
+      auto end = std::next(it);
+      while (end != result._nodes.end() && end->first.compare(0, it->first.size(), it->first) == 0) ++end;
+      result._nodes.erase(std::next(it), end);
+    }
+    return result;
+  }
+
+  /**
+   * Returns the ID of the transaction the digest was computed in.
+   */
+  std::size_t txnid() const noexcept {
+    return _txnid;
+  }
+
+  /**
+   * Returns the nodes, keyed by prefix.
+   */
+  const std::map<std::string, node>& nodes() const noexcept {
+    return _nodes;
+  }
+
+  /**
+   * Returns the node covering the whole database.
+   */
+  node root() const {
+    return find(std::string_view{});
+  }
+
+  /**
+   * Returns the key ranges in which this digest and another differ, in key order
+   * and coalesced where adjacent. Records outside them are identical (barring
+   * hash collisions).
+   */
+  std::vector<range> diff(const digest_tree& other) const {
+    std::vector<range> result;
+    diff(other, std::string(), result);
+    return result;
+  }
+
+  /**
+   * Serializes the digest, to send to a replica.
+   */
+  std::string encode() const {
+    std::string result(8, '\0');
+    cmp::detail::store<std::uint64_t, false>(result.data(), _txnid);
+    for (const auto& n : _nodes) {
+      char fixed[20];
+      cmp::detail::store<std::uint32_t, false>(fixed, static_cast<std::uint32_t>(n.first.size()));
+      cmp::detail::store<std::uint64_t, false>(fixed + 4, n.second.count);
+      cmp::detail::store<std::uint64_t, false>(fixed + 12, n.second.hash);
+      result.append(fixed, sizeof(fixed));
+      result += n.first;
+    }
+    return result;
+  }
+
+  /**
+   * Deserializes a digest made by `encode()`.
+   *
+   * @throws lmdb::error `MDB_CORRUPTED` if the input is malformed
+   */
+  static digest_tree decode(std::string_view data) {
+    digest_tree result;
+    if (data.size() < 8) error::raise("digest_tree::decode", MDB_CORRUPTED);
+    result._txnid = static_cast<std::size_t>(cmp::detail::load<std::uint64_t, false>(data.data()));
+    data.remove_prefix(8);
+    while (!data.empty()) {
+      if (data.size() < 20) error::raise("digest_tree::decode", MDB_CORRUPTED);
+      const std::size_t len = cmp::detail::load<std::uint32_t, false>(data.data());
+      node n;
+      n.count = cmp::detail::load<std::uint64_t, false>(data.data() + 4);
+      n.hash = cmp::detail::load<std::uint64_t, false>(data.data() + 12);
+      data.remove_prefix(20);
+      if (data.size() < len) error::raise("digest_tree::decode", MDB_CORRUPTED);
+      result._nodes.emplace(std::string(data.substr(0, len)), n);
+      data.remove_prefix(len);
+    }
+    return result;
+  }
+
+protected:
+  std::map<std::string, node> _nodes;
+  std::size_t _txnid{0};
+
+  node find(const std::string_view prefix) const {
+    const auto it = _nodes.find(std::string(prefix));
+    return it == _nodes.end() ? node{} : it->second;
+  }
+
+  /* Returns the direct children of a node. */
+  std::vector<std::string> children(const std::string& prefix) const {
+    std::vector<std::string> result;
+    auto it = _nodes.upper_bound(prefix);
+    while (it != _nodes.end() && it->first.size() > prefix.size() && it->first.compare(0, prefix.size(), prefix) == 0) {
+      result.push_back(it->first.substr(0, prefix.size() + 1));
+      const std::string next = lmdb::dbi::prefix_end(result.back());
+      if (next.empty()) break;
+      it = _nodes.lower_bound(next);
+    }
+    return result;
+  }
+
+  void diff(const digest_tree& other,
+            const std::string& prefix,
+            std::vector<range>& result) const {
+    node mine = find(prefix), theirs = other.find(prefix);
+    if (mine == theirs) return;
+
+    const auto add = [&result](std::string lo, std::string hi) {
+      if (!result.empty() && !result.back().second.empty() && result.back().second == lo) result.back().second = std::move(hi);
+      else result.emplace_back(std::move(lo), std::move(hi));
+    };
+
+    auto a = children(prefix), b = other.children(prefix);
+    if (a.empty() || b.empty()) {
+      add(prefix, lmdb::dbi::prefix_end(prefix));
+      return;
+    }
+
+    // The key equal to the prefix is counted by the node, but by none of its children
+    std::vector<std::string> all;
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(all));
+    for (const auto& c : a) mine -= find(c);
+    for (const auto& c : b) theirs -= other.find(c);
+    if (mine != theirs) add(prefix, prefix + '\0');
+    for (const auto& c : all) diff(other, c, result);
+  }
+
+  /* Scans `[lo, hi)`, returning its nodes. Nodes wholly inside the range are already pruned. */
+  static std::vector<std::pair<std::string, node>> scan(MDB_txn* const txn,
+                                                       const MDB_dbi dbi,
+                                                       const std::string& lo,
+                                                       const std::string& hi,
+                                                       const digest_options& options) {
+    struct open_node {
+      node n;
+      std::size_t mark;  // size of the output when the node was opened
+      bool partial;      // may also have entries outside the range
+    };
+    std::vector<std::pair<std::string, node>> out;
+    std::vector<open_node> stack;  // one per byte of `current`, plus the root
+    std::string current;
+
+    const auto close = [&](const std::size_t depth, const bool at_end) {
+      while (stack.size() > depth + 1) {
+        open_node o = stack.back();
+        stack.pop_back();
+        const bool partial = o.partial || (at_end && !hi.empty());
+        if (!partial && o.n.count <= options.leaf_entries) out.resize(o.mark);
+        out.emplace_back(current.substr(0, stack.size()), o.n);
+      }
+      current.resize(std::min(current.size(), depth));
+    };
+
+    const MDB_val hiV{hi.size(), const_cast<char*>(hi.data())};
+    auto cursor = lmdb::cursor::open(txn, dbi);
+    std::string_view key{lo}, val;
+    for (bool found = cursor.get(key, val, lo.empty() ? MDB_FIRST : MDB_SET_RANGE); found; found = cursor.get(key, val, MDB_NEXT)) {
+      const MDB_val keyV{key.size(), const_cast<char*>(key.data())};
+      if (!hi.empty() && lmdb::dbi_cmp(txn, dbi, &keyV, &hiV) >= 0) break;
+
+      const std::string_view prefix = key.substr(0, options.max_depth);
+      const bool first = stack.empty();
+      if (first) stack.push_back({node{}, out.size(), !lo.empty()});
+      std::size_t common = 0;
+      while (common < current.size() && common < prefix.size() && current[common] == prefix[common]) common++;
+      close(common, false);
+      for (std::size_t d = common; d < prefix.size(); d++) {
+        current.push_back(prefix[d]);
+        stack.push_back({node{}, out.size(), first && !lo.empty()});
+      }
+
+      const node record{1, hash(key, val)};
+      for (auto& o : stack) o.n += record;
+    }
+
+    if (!stack.empty()) {
+      close(0, true);
+      out.emplace_back(std::string(), stack.back().n);
+    }
+    return out;
+  }
+};
+
+/**
+ * Keeps the last digest computed for each database (of each environment, and
+ * with each shape of `digest_options`), and only recomputes it when asked for a
+ * digest of a different snapshot.
+ *
+ * @note This class is not thread-safe.
+ */
+class lmdb::digest_cache {
+protected:
+  /* Environment, database, max_depth and leaf_entries: `threads` doesn't change the digest. */
+  using slot = std::tuple<MDB_env*, MDB_dbi, std::size_t, std::size_t>;
+
+  std::map<slot, digest_tree> _trees;
+  digest_tree _uncached;
+
+public:
+  /**
+   * Returns the digest of a database in the snapshot of `txn`.
+   *
+   * A write transaction's ID doesn't change as it writes, so its digests are
+   * never cached: each call recomputes, and the result is only valid until the
+   * next call.
+   *
+   * @throws lmdb::error on failure
+   * @note Snapshots are told apart by transaction ID, which is read from LMDB's
+   *       internal structures unless `LMDBXX_TXN_ID` is defined.
+   */
+  const digest_tree& get(MDB_txn* const txn,
+                         const MDB_dbi dbi,
+                         const digest_options& options = {}) {
+    if (!internal::read_only(txn)) return _uncached = digest_tree::compute(txn, dbi, options);
+    const slot key{lmdb::txn_env(txn), dbi, options.max_depth, options.leaf_entries};
+    const auto it = _trees.find(key);
+    if (it != _trees.end() && it->second.txnid() == internal::txn_id(txn)) return it->second;
+    return _trees[key] = digest_tree::compute(txn, dbi, options);
+  }
+
+  /**
+   * Forgets all cached digests.
+   */
+  void clear() noexcept {
+    _trees.clear();
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Queues */
+
+namespace lmdb {
+  class queue;
+}
+
+/**
+ * A persistent FIFO queue. Entries are keyed by a sequence number in an
+ * `MDB_INTEGERKEY` database, so enqueueing appends at the right edge of the
+ * B+tree with `MDB_APPEND`, and dequeueing deletes from the left edge.
+ *
+ * Besides destructive `pop()`, any number of consumer groups can read the
+ * queue independently. Each group's acknowledged offset (the next sequence
+ * number it will read) is kept in a companion database, named with ".groups"
+ * appended (or "groups" for the main database). `trim()` removes entries that
+ * every group has acknowledged.
+ *
+ * The next sequence number to push is also kept in the companion database, so
+ * numbers are never reused after the queue drains. Group names starting with a
+ * zero byte are reserved, and refused with `MDB_BAD_VALSIZE`.
+ */
+class lmdb::queue {
+protected:
+  MDB_dbi _data{0};
+  MDB_dbi _groups{0};
+
+  /* The key, in the groups database, of the next sequence number to push. */
+  static constexpr std::string_view next_key{"\0next", 5};
+
+  static bool reserved(const std::string_view group) noexcept {
+    return !group.empty() && group[0] == '\0';
+  }
+
+  static void check_group(const char* const origin,
+                          const std::string_view group) {
+    if (reserved(group)) error::raise(origin, MDB_BAD_VALSIZE);
+  }
+
+  static std::size_t seq(const std::string_view key) {
+    return from_sv<std::size_t>(key);
+  }
+
+public:
+  using callback = std::function<void(std::size_t seq, std::string_view val)>;
+
+  /**
+   * Opens the queue's databases.
+   *
+   * @param txn a transaction handle
+   * @param name the database name, or nullptr
+   * @param flags dbi flags, ie MDB_CREATE (`MDB_INTEGERKEY` is added)
+   * @throws lmdb::error on failure
+   */
+  static queue open(MDB_txn* const txn,
+                    const char* const name = nullptr,
+                    const unsigned int flags = dbi::default_flags) {
+    const std::string groups_name = name ? std::string(name) + ".groups" : std::string("groups");
+    queue result;
+    result._data = dbi::open(txn, name, flags | MDB_INTEGERKEY).handle();
+    result._groups = dbi::open(txn, groups_name.c_str(), flags & MDB_CREATE).handle();
+    return result;
+  }
+
+  /**
+   * Returns the handle of the database holding the entries.
+   */
+  MDB_dbi handle() const noexcept {
+    return _data;
+  }
+
+  /**
+   * Returns the number of entries in the queue.
+   *
+   * @throws lmdb::error on failure
+   */
+  std::size_t size(MDB_txn* const txn) const {
+    return dbi{_data}.size(txn);
+  }
+
+  /**
+   * Returns the sequence number of the first entry, or of the next entry to be pushed if the queue is empty.
+   *
+   * @throws lmdb::error on failure
+   */
+  std::size_t head(MDB_txn* const txn) const {
+    auto cursor = lmdb::cursor::open(txn, _data);
+    std::string_view key, val;
+    return cursor.get(key, val, MDB_FIRST) ? seq(key) : tail(txn);
+  }
+
+  /**
+   * Returns the sequence number the next entry pushed will get.
+   *
+   * @throws lmdb::error on failure
+   */
+  std::size_t tail(MDB_txn* const txn) const {
+    std::string_view key, val;
+    if (dbi{_groups}.get(txn, next_key, val)) return from_sv<std::size_t>(val);
+    // A queue that has never been pushed to
+    auto cursor = lmdb::cursor::open(txn, _data);
+    return cursor.get(key, val, MDB_LAST) ? seq(key) + 1 : 0;
+  }
+
+  /**
+   * Appends an entry.
+   *
+   * @param txn a write transaction handle
+   * @param val
+   * @returns the sequence number of the entry
+   * @throws lmdb::error on failure
+   */
+  std::size_t push(MDB_txn* const txn,
+                   const std::string_view val) {
+    return push(txn, &val, &val + 1);
+  }
+
+  /**
+   * Appends a batch of entries with one cursor.
+   *
+   * @param txn a write transaction handle
+   * @param first, last the values to append
+   * @returns the sequence number of the first entry
+   * @throws lmdb::error on failure
+   */
+  template<typename It>
+  std::size_t push(MDB_txn* const txn,
+                   It first,
+                   const It last) {
+    const std::size_t result = tail(txn);
+    std::size_t next = result;
+    auto cursor = lmdb::cursor::open(txn, _data);
+    for (; first != last; ++first, ++next) {
+      cursor.put(to_sv(next), std::string_view(*first), MDB_APPEND);
+    }
+    if (next != result) dbi{_groups}.put(txn, next_key, to_sv(next));
+    return result;
+  }
+
+  /**
+   * Removes up to `n` entries from the head of the queue, calling `fn(seq, val)`
+   * on each before it is deleted.
+   *
+   * @param txn a write transaction handle
+   * @param n the most entries to remove
+   * @param fn may be empty
+   * @returns the number of entries removed
+   * @throws lmdb::error on failure
+   */
+  std::size_t pop(MDB_txn* const txn,
+                  const std::size_t n,
+                  const callback& fn = {}) {
+    std::size_t result = 0;
+    auto cursor = lmdb::cursor::open(txn, _data);
+    std::string_view key, val;
+    for (bool found = cursor.get(key, val, MDB_FIRST); found && result < n; found = cursor.get(key, val, MDB_NEXT)) {
+      if (fn) fn(seq(key), val);
+      cursor.del();
+      result++;
+    }
+    return result;
+  }
+
+  /**
+   * Returns the acknowledged offset of a consumer group: the sequence number it reads next.
+   * A new group starts at the head of the queue.
+   *
+   * @throws lmdb::error on failure, or `MDB_BAD_VALSIZE` for a reserved group name
+   */
+  std::size_t offset(MDB_txn* const txn,
+                     const std::string_view group) const {
+    check_group("queue::offset", group);
+    std::string_view val;
+    if (!dbi{_groups}.get(txn, group, val)) return head(txn);
+    return std::max(from_sv<std::size_t>(val), head(txn));
+  }
+
+  /**
+   * Calls `fn(seq, val)` on up to `n` entries after a consumer group's offset, without removing them.
+   *
+   * @returns the number of entries read
+   * @throws lmdb::error on failure, or `MDB_BAD_VALSIZE` for a reserved group name
+   */
+  std::size_t read(MDB_txn* const txn,
+                   const std::string_view group,
+                   const std::size_t n,
+                   const callback& fn) const {
+    check_group("queue::read", group);
+    std::size_t result = 0;
+    const std::size_t from = offset(txn, group);
+    auto cursor = lmdb::cursor::open(txn, _data);
+    std::string_view key{to_sv(from)}, val;
+    for (bool found = cursor.get(key, val, MDB_SET_RANGE); found && result < n; found = cursor.get(key, val, MDB_NEXT)) {
+      fn(seq(key), val);
+      result++;
+    }
+    return result;
+  }
+
+  /**
+   * Acknowledges every entry up to and including `seq` for a consumer group.
+   * Offsets only move forward.
+   *
+   * @throws lmdb::error on failure, or `MDB_BAD_VALSIZE` for a reserved group name
+   */
+  void ack(MDB_txn* const txn,
+           const std::string_view group,
+           const std::size_t seq) {
+    check_group("queue::ack", group);
+    if (seq + 1 > offset(txn, group)) dbi{_groups}.put(txn, group, to_sv<std::size_t>(seq + 1));
+  }
+
+  /**
+   * Removes a consumer group, so it no longer holds back `trim()`.
+   *
+   * @throws lmdb::error on failure, or `MDB_BAD_VALSIZE` for a reserved group name
+   */
+  bool remove_group(MDB_txn* const txn,
+                    const std::string_view group) {
+    check_group("queue::remove_group", group);
+    return dbi{_groups}.del(txn, group);
+  }
+
+  /**
+   * Removes up to `limit` entries, from the head, that every consumer group has acknowledged.
+   *
+   * @returns the number of entries removed
+   * @throws lmdb::error on failure
+   */
+  std::size_t trim(MDB_txn* const txn,
+                   const std::size_t limit = SIZE_MAX) {
+    std::size_t lowest = SIZE_MAX;
+    auto groups = lmdb::cursor::open(txn, _groups);
+    std::string_view key, val;
+    for (bool found = groups.get(key, val, MDB_FIRST); found; found = groups.get(key, val, MDB_NEXT)) {
+      if (!reserved(key)) lowest = std::min(lowest, from_sv<std::size_t>(val));
+    }
+    if (lowest == SIZE_MAX) return 0;
+
+    std::size_t result = 0;
+    auto cursor = lmdb::cursor::open(txn, _data);
+    for (bool found = cursor.get(key, val, MDB_FIRST); found && result < limit && seq(key) < lowest; found = cursor.get(key, val, MDB_NEXT)) {
+      cursor.del();
+      result++;
+    }
+    return result;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Sequences */
+
+namespace lmdb {
+  class sequence;
+}
+
+/**
+ * Allocates unique, increasing IDs without a write transaction per ID. The
+ * sequence persists a high-water mark under a key of a database, and reserves
+ * blocks of IDs above it in a write transaction. IDs are then handed out of
+ * the current block by an atomic increment, so threads don't contend for a lock.
+ *
+ * Only exhausting a block takes a lock and a write transaction. The block size
+ * adapts to the allocation rate: it doubles when a block lasts less than
+ * `target`, and halves when one lasts more than four times as long (up to 2^31).
+ * Blocks are kept in a small ring of slots, so reserving one allocates nothing.
+ *
+ * Several processes (or sequence instances) can share a sequence, since every
+ * block is reserved against the persisted mark. IDs left in a block when the
+ * process exits are never handed out, so a sequence has gaps.
+ */
+class lmdb::sequence {
+protected:
+  /* A reserved block. Slots are reused round-robin, so readers check the generation. */
+  struct slot {
+    std::atomic<std::uint32_t> generation{0};
+    std::atomic<std::size_t> start{0};
+    std::atomic<std::size_t> size{0};
+  };
+
+  static constexpr std::size_t slot_count = 4;
+  static constexpr std::size_t block_limit = std::size_t(1) << 31;
+
+  MDB_env* _env;
+  MDB_dbi _dbi;
+  std::string _key;
+  std::size_t _min_block;
+  std::size_t _max_block;
+  std::chrono::milliseconds _target;
+  std::size_t _block_size;
+  std::chrono::steady_clock::time_point _reserved_at;
+  std::mutex _mutex;
+  std::uint32_t _generation{0};  // of the current block, 0 before the first
+  std::array<slot, slot_count> _slots;
+  /* The current generation in the high 32 bits, and the offset of the next ID in its block in the low 32. */
+  std::atomic<std::uint64_t> _next{0};
+
+  /* Reserves the next block. Called with `_mutex` held. */
+  void reserve() {
+    const auto now = std::chrono::steady_clock::now();
+    if (_generation) {
+      const auto lasted = now - _reserved_at;
+      if (lasted < _target) _block_size = std::min(_block_size * 2, _max_block);
+      else if (lasted > 4 * _target) _block_size = std::max(_block_size / 2, _min_block);
+    }
+
+    auto txn = lmdb::txn::begin(_env);
+    std::string_view val;
+    const std::size_t start = dbi{_dbi}.get(txn, _key, val) ? from_sv<std::size_t>(val) : 0;
+    if (start > SIZE_MAX - _block_size) error::raise("sequence::reserve", MDB_BAD_VALSIZE);
+    dbi{_dbi}.put(txn, _key, to_sv<std::size_t>(start + _block_size));
+    txn.commit();
+
+    if (++_generation == 0) _generation = 1;
+    // Written like a seqlock: readers of the slot's previous block see its generation change
+    slot& s = _slots[_generation % slot_count];
+    s.generation.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.start.store(start, std::memory_order_relaxed);
+    s.size.store(_block_size, std::memory_order_relaxed);
+    s.generation.store(_generation, std::memory_order_release);
+    _next.store(std::uint64_t(_generation) << 32, std::memory_order_release);
+    _reserved_at = now;
+  }
+
+public:
+  /**
+   * Constructor. No block is reserved until the first call to `next()`.
+   *
+   * @param env the environment handle
+   * @param dbi the database holding the high-water mark
+   * @param key the key of the high-water mark
+   * @param min_block the smallest (and first) block size
+   * @param max_block the largest block size
+   * @param target how long a block should last
+   */
+  sequence(MDB_env* const env,
+           const MDB_dbi dbi,
+           const std::string_view key,
+           const std::size_t min_block = 16,
+           const std::size_t max_block = 1 << 20,
+           const std::chrono::milliseconds target = std::chrono::seconds(1))
+    : _env{env}, _dbi{dbi}, _key{key},
+      _min_block{std::clamp<std::size_t>(min_block, 1, block_limit)},
+      _max_block{std::clamp(max_block, _min_block, block_limit)},
+      _target{target},
+      _block_size{_min_block} {}
+
+  sequence(const sequence&) = delete;
+  sequence& operator=(const sequence&) = delete;
+
+  /**
+   * Returns a new ID. Safe to call from any number of threads.
+   *
+   * @throws lmdb::error if a block has to be reserved and that fails
+   * @note Reserving a block begins a write transaction, so this must not be
+   *       called from a thread that already holds one.
+   */
+  std::size_t next() {
+    for (;;) {
+      const std::uint64_t next = _next.fetch_add(1, std::memory_order_acquire);
+      const std::uint32_t generation = std::uint32_t(next >> 32);
+      const std::size_t offset = std::size_t(next & 0xFFFFFFFF);
+      if (generation) {
+        const slot& s = _slots[generation % slot_count];
+        const std::uint32_t before = s.generation.load(std::memory_order_acquire);
+        const std::size_t start = s.start.load(std::memory_order_relaxed);
+        const std::size_t size = s.size.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // A mismatch means the slot was reused: the ID is skipped, leaving a gap
+        if (before == generation && s.generation.load(std::memory_order_relaxed) == generation && offset < size) return start + offset;
+      }
+      std::lock_guard<std::mutex> lock{_mutex};
+      if (_generation == generation) reserve();
+    }
+  }
+
+  /**
+   * Returns the size of the next block to be reserved.
+   */
+  std::size_t block_size() {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _block_size;
+  }
+
+  /**
+   * Returns the persisted high-water mark: every ID handed out so far is below it.
+   *
+   * @throws lmdb::error on failure
+   */
+  std::size_t high_water(MDB_txn* const txn) const {
+    std::string_view val;
+    return dbi{_dbi}.get(txn, _key, val) ? from_sv<std::size_t>(val) : 0;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Optimistic Transactions */
+
+namespace lmdb {
+  class optimistic_txn;
+}
+
+/**
+ * Runs read-modify-write transactions optimistically, so that the write lock is
+ * only held to validate and apply their results. See `optimistic_txn::run()`.
+ *
+ * Only point reads made with `get()` are validated: reads made directly with
+ * `handle()`, such as cursor scans, aren't tracked, so can't cause a retry.
+ */
+class lmdb::optimistic_txn {
+protected:
+  using record = std::pair<MDB_dbi, std::string>;
+
+  MDB_txn* _txn{nullptr};
+  /* The first value seen for each key read (nothing for a missing key). */
+  std::map<record, std::optional<std::string>> _reads;
+  /* Buffered writes (nothing for a delete), applied in key order. */
+  std::map<record, std::optional<std::string>> _writes;
+
+  explicit optimistic_txn(MDB_txn* const txn) noexcept
+    : _txn{txn} {}
+
+  /* Checks that every value read is unchanged in `txn`. */
+  bool validate(MDB_txn* const txn) const {
+    for (const auto& r : _reads) {
+      std::string_view val;
+      const bool found = dbi{r.first.first}.get(txn, r.first.second, val);
+      if (found != r.second.has_value() || (found && val != *r.second)) return false;
+    }
+    return true;
+  }
+
+  void apply(MDB_txn* const txn) const {
+    for (const auto& w : _writes) {
+      if (w.second) dbi{w.first.first}.put(txn, w.first.second, *w.second);
+      else dbi{w.first.first}.del(txn, w.first.second);
+    }
+  }
+
+public:
+  /**
+   * Runs `fn(optimistic_txn&)`: first in a read-only transaction, buffering its
+   * writes, then in a short write transaction that checks that every value it
+   * read is unchanged, and applies its writes. On a conflict `fn` runs again,
+   * and the last of `max_attempts` attempts runs inside the write transaction,
+   * so it can't conflict.
+   *
+   * @param env the environment handle
+   * @param fn the transaction body. It may run several times, so it should have
+   *        no effects beyond `optimistic_txn` and its return value.
+   * @param max_attempts
+   * @returns the value returned by the attempt that committed
+   * @throws lmdb::error on failure, or whatever `fn` throws
+   * @note Not for use in a thread that has a transaction open.
+   */
+  template<typename F>
+  static auto run(MDB_env* const env,
+                  F&& fn,
+                  const std::size_t max_attempts = 8) {
+    for (std::size_t attempt = 1;; attempt++) {
+      if (attempt >= max_attempts) {
+        auto txn = lmdb::txn::begin(env);
+        optimistic_txn t{txn};
+        if constexpr (std::is_void_v<decltype(fn(t))>) {
+          fn(t);
+          t.apply(txn);
+          txn.commit();
+          return;
+        } else {
+          auto result = fn(t);
+          t.apply(txn);
+          txn.commit();
+          return result;
+        }
+      }
+
+      auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+      optimistic_txn t{rtxn};
+      const auto commit = [&] {
+        rtxn.abort();
+        t._txn = nullptr;
+        auto wtxn = lmdb::txn::begin(env);
+        if (!t.validate(wtxn)) return false;
+        t.apply(wtxn);
+        wtxn.commit();
+        return true;
+      };
+      if constexpr (std::is_void_v<decltype(fn(t))>) {
+        fn(t);
+        if (commit()) return;
+      } else {
+        auto result = fn(t);
+        if (commit()) return result;
+      }
+    }
+  }
+
+  /**
+   * Returns the underlying transaction, for reads that needn't be validated.
+   */
+  MDB_txn* handle() const noexcept {
+    return _txn;
+  }
+
+  /**
+   * Retrieves a value, seeing this transaction's own writes, and records it for validation.
+   *
+   * @param dbi a database handle
+   * @param key
+   * @param val set to a view that is valid until the next write to this key
+   * @returns true if the key was found
+   * @throws lmdb::error on failure
+   */
+  bool get(const MDB_dbi dbi,
+           const std::string_view key,
+           std::string_view& val) {
+    record r{dbi, std::string(key)};
+    const auto w = _writes.find(r);
+    if (w != _writes.end()) {
+      if (!w->second) return false;
+      val = *w->second;
+      return true;
+    }
+    auto it = _reads.find(r);
+    if (it == _reads.end()) {
+      std::string_view found;
+      std::optional<std::string> copy;
+      if (lmdb::dbi{dbi}.get(_txn, key, found)) copy.emplace(found);
+      it = _reads.emplace(std::move(r), std::move(copy)).first;
+    }
+    if (!it->second) return false;
+    val = *it->second;
+    return true;
+  }
+
+  /**
+   * Buffers a write, to be applied on commit.
+   */
+  void put(const MDB_dbi dbi,
+           const std::string_view key,
+           const std::string_view val) {
+    _writes[record{dbi, std::string(key)}] = std::string(val);
+  }
+
+  /**
+   * Buffers a delete, to be applied on commit.
+   */
+  void del(const MDB_dbi dbi,
+           const std::string_view key) {
+    _writes[record{dbi, std::string(key)}] = std::nullopt;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Skip Scans */
+
+namespace lmdb {
+  class skip_scan;
+}
+
+/**
+ * Iterates over the entries of a database with composite keys whose suffix
+ * (the part after a leading component) lies in `[lo, hi)`, without scanning
+ * the entries in between. For each distinct leading component `lead`, the
+ * cursor jumps to `lead + lo` with `MDB_SET_RANGE`, scans until `lead + hi`,
+ * and then jumps to the next leading component. This takes about two seeks
+ * per distinct lead, rather than a scan of the whole database.
+ *
+ * Jumping to the next lead seeks past every key that starts with the current
+ * one, so leading components must sort as their bytes do (strings, big-endian
+ * integers), and no lead may be a prefix of another (ie fixed width).
+ */
+class lmdb::skip_scan {
+public:
+  /* Returns the length of a key's leading component. */
+  using lead_fn = std::function<std::size_t(std::string_view key)>;
+
+protected:
+  MDB_txn* _txn;
+  MDB_dbi _dbi;
+  lmdb::cursor _cursor;
+  lead_fn _lead;
+  std::string _lo;
+  std::string _hi;
+  std::string _current;
+  std::string _lo_key;
+  std::string _hi_key;
+  std::size_t _seeks{0};
+  bool _started{false};
+  bool _in_lead{false};
+  bool _done{false};
+
+  skip_scan(MDB_txn* const txn,
+            const MDB_dbi dbi,
+            lead_fn lead,
+            const std::string_view lo,
+            const std::string_view hi)
+    : _txn{txn}, _dbi{dbi}, _cursor{lmdb::cursor::open(txn, dbi)}, _lead{std::move(lead)}, _lo{lo}, _hi{hi} {}
+
+  int compare(const std::string_view a,
+              const std::string_view b) const noexcept {
+    const MDB_val av{a.size(), const_cast<char*>(a.data())};
+    const MDB_val bv{b.size(), const_cast<char*>(b.data())};
+    return lmdb::dbi_cmp(_txn, _dbi, &av, &bv);
+  }
+
+  bool seek(const std::string& target,
+            std::string_view& key,
+            std::string_view& val) {
+    _seeks++;
+    key = target;
+    return _cursor.get(key, val, MDB_SET_RANGE);
+  }
+
+public:
+  /**
+   * Returns a `lead_fn` for leading components of a fixed width.
+   */
+  static lead_fn fixed(const std::size_t width) {
+    return [width](const std::string_view key) { return std::min(width, key.size()); };
+  }
+
+  /**
+   * Returns a `lead_fn` taking the extent of a comparator's first component,
+   * ie `skip_scan::by<cmp::big_endian<uint32_t>>()`.
+   */
+  template<typename C>
+  static lead_fn by() {
+    return [](const std::string_view key) { return C::extent(key.data(), key.size()); };
+  }
+
+  /**
+   * Opens a skip scan.
+   *
+   * @param txn a transaction handle
+   * @param dbi a database handle
+   * @param lead returns the length of a key's leading component
+   * @param lo the lowest suffix, or empty for no lower bound
+   * @param hi the suffix to stop at, or empty for no upper bound
+   * @throws lmdb::error on failure
+   */
+  static skip_scan open(MDB_txn* const txn,
+                        const MDB_dbi dbi,
+                        lead_fn lead,
+                        const std::string_view lo,
+                        const std::string_view hi) {
+    return skip_scan{txn, dbi, std::move(lead), lo, hi};
+  }
+
+  /**
+   * Retrieves the next entry in range.
+   *
+   * @returns false when there are no more
+   * @throws lmdb::error on failure
+   */
+  bool get(std::string_view& key,
+           std::string_view& val) {
+    if (_done) return false;
+    std::string_view k, v;
+    bool found;
+    if (!_started) {
+      _started = true;
+      _seeks++;
+      found = _cursor.get(k, v, MDB_FIRST);
+    } else {
+      found = _cursor.get(k, v, MDB_NEXT);
+    }
+
+    while (found) {
+      const std::string_view lead = k.substr(0, _lead(k));
+      if (!_in_lead || lead != _current) {
+        _in_lead = true;
+        _current.assign(lead);
+        _lo_key = _current + _lo;
+        _hi_key = _current + _hi;
+        if (!_lo.empty() && compare(k, _lo_key) < 0) {
+          found = seek(_lo_key, k, v);
+          continue;
+        }
+      }
+      if (_hi.empty() || compare(k, _hi_key) < 0) {
+        key = k;
+        val = v;
+        return true;
+      }
+      const std::string next = dbi::prefix_end(_current);
+      if (next.empty()) break;
+      found = seek(next, k, v);
+    }
+    _done = true;
+    return false;
+  }
+
+  /**
+   * Returns the number of cursor seeks made so far.
+   */
+  std::size_t seeks() const noexcept {
+    return _seeks;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Aggregate Views */
+
+namespace lmdb {
+  struct aggregate;
+  class aggregate_dbi;
+}
+
+/**
+ * Count, sum, minimum and maximum of the values in one group of an aggregate view.
+ */
+struct lmdb::aggregate {
+  std::int64_t count;
+  std::int64_t sum;
+  std::int64_t min;
+  std::int64_t max;
+
+  double mean() const noexcept {
+    return count ? double(sum) / count : 0.0;
+  }
+};
+
+/**
+ * A database with aggregate views, which are kept up to date by `put()` and
+ * `del()` in the same write transaction. A view groups records (by key prefix,
+ * or with any function of the key and value), and maintains the count, sum,
+ * minimum and maximum of a number taken from each record.
+ *
+ * Aggregates are stored in a companion database, named with ".agg" appended (or
+ * "agg" for the main database), under the view name, a zero byte and the group,
+ * so reading one takes a single lookup. Each group also counts the records that
+ * reach its minimum and maximum, and is only rescanned when the last of them is
+ * removed or overwritten with a value inside the range.
+ *
+ * Views are registered in memory with `add_view()`, so every process that writes
+ * the database must register the same views. `rebuild()` recomputes a view from
+ * the records, ie after adding it to an existing database.
+ *
+ * @note The data database must not be `MDB_DUPSORT`.
+ */
+class lmdb::aggregate_dbi {
+public:
+  /** Returns the group of a record, or nothing to leave the record out of the view. */
+  using group_fn = std::function<std::optional<std::string>(std::string_view key, std::string_view val)>;
+  /** Returns the number a record contributes to its group's sum, minimum and maximum. */
+  using value_fn = std::function<std::int64_t(std::string_view key, std::string_view val)>;
+
+protected:
+  struct view {
+    std::string name;
+    group_fn group;
+    value_fn value;
+    std::size_t prefix;  // groups are key prefixes of this length, or 0
+  };
+
+  MDB_dbi _data{0};
+  MDB_dbi _aggregates{0};
+  std::vector<view> _views;
+
+  static std::string aggregate_key(const std::string_view name,
+                                   const std::string_view group) {
+    std::string result{name};
+    result.push_back('\0');
+    result += group;
+    return result;
+  }
+
+  const view& find(const std::string_view name) const {
+    for (const auto& v : _views) {
+      if (v.name == name) return v;
+    }
+    error::raise("aggregate_dbi", MDB_NOTFOUND);
+  }
+
+  /* As stored: the aggregate, and how many records reach its minimum and maximum. */
+  struct record {
+    aggregate agg;
+    std::int64_t min_ties;
+    std::int64_t max_ties;
+  };
+
+  static void include(record& r,
+                      const std::int64_t x) noexcept {
+    aggregate& a = r.agg;
+    if (!a.count || x < a.min) a.min = x, r.min_ties = 0;
+    if (!a.count || x > a.max) a.max = x, r.max_ties = 0;
+    r.min_ties += (x == a.min);
+    r.max_ties += (x == a.max);
+    a.count++;
+    a.sum += x;
+  }
+
+  /* Leaves a tie count at 0 when the last record reaching that extremum is removed. */
+  static void exclude(record& r,
+                      const std::int64_t x) noexcept {
+    aggregate& a = r.agg;
+    if (x == a.min) r.min_ties--;
+    if (x == a.max) r.max_ties--;
+    a.count--;
+    a.sum -= x;
+  }
+
+  static std::int64_t value_of(const view& v,
+                               const std::string_view key,
+                               const std::string_view val) {
+    return v.value ? v.value(key, val) : 0;
+  }
+
+  /* Recomputes one group from the records, for when its minimum or maximum is no longer reached. */
+  record recompute(MDB_txn* const txn,
+                   const view& v,
+                   const std::string& group) const {
+    record result{};
+    auto cursor = lmdb::cursor::open(txn, _data);
+    std::string_view key{group}, val;
+    const std::string end = v.prefix ? dbi::prefix_end(group) : std::string();
+    for (bool found = cursor.get(key, val, v.prefix ? MDB_SET_RANGE : MDB_FIRST); found; found = cursor.get(key, val, MDB_NEXT)) {
+      if (v.prefix && !end.empty() && key >= end) break;
+      const auto g = v.group(key, val);
+      if (!g || *g != group) continue;
+      include(result, value_of(v, key, val));
+    }
+    return result;
+  }
+
+  /* Applies `fn(record&)` to one group, after the data database has been written. */
+  template<typename F>
+  void modify(MDB_txn* const txn,
+              const view& v,
+              const std::string& group,
+              F&& fn) {
+    const std::string akey = aggregate_key(v.name, group);
+    std::string_view stored;
+    record r = dbi{_aggregates}.get(txn, akey, stored) ? from_sv<record>(stored) : record{};
+    fn(r);
+    if (r.agg.count <= 0) {
+      dbi{_aggregates}.del(txn, akey);
+      return;
+    }
+    // Count-only views never rescan: their values are all 0, so every record ties
+    if (v.value && (r.min_ties <= 0 || r.max_ties <= 0)) r = recompute(txn, v, group);
+    dbi{_aggregates}.put(txn, akey, to_sv(r));
+  }
+
+  /* Moves a record from its old value (if any) to its new one (if any) in every view. */
+  void update(MDB_txn* const txn,
+              const std::string_view key,
+              const std::optional<std::string_view> old,
+              const std::optional<std::string_view> val) {
+    for (const auto& v : _views) {
+      const auto old_group = old ? v.group(key, *old) : std::nullopt;
+      const auto new_group = val ? v.group(key, *val) : std::nullopt;
+      if (old_group && new_group && *old_group == *new_group) {
+        if (!v.value) continue;
+        const std::int64_t from = v.value(key, *old), to = v.value(key, *val);
+        if (from == to) continue;
+        modify(txn, v, *new_group, [&](record& r) {
+          exclude(r, from);
+          include(r, to);
+        });
+        continue;
+      }
+      if (old_group) modify(txn, v, *old_group, [&](record& r) { exclude(r, value_of(v, key, *old)); });
+      if (new_group) modify(txn, v, *new_group, [&](record& r) { include(r, value_of(v, key, *val)); });
+    }
+  }
+
+public:
+  /**
+   * Returns a `group_fn` grouping records by the first `n` bytes of their key.
+   */
+  static group_fn prefix(const std::size_t n) {
+    return [n](const std::string_view key, std::string_view) { return std::optional<std::string>(key.substr(0, n)); };
+  }
+
+  /**
+   * Opens the data database and its aggregate database.
+   *
+   * @param txn a transaction handle
+   * @param name the database name, or nullptr
+   * @param flags dbi flags, ie MDB_CREATE
+   * @throws lmdb::error on failure
+   */
+  static aggregate_dbi open(MDB_txn* const txn,
+                            const char* const name = nullptr,
+                            const unsigned int flags = dbi::default_flags) {
+    const std::string agg_name = name ? std::string(name) + ".agg" : std::string("agg");
+    aggregate_dbi result;
+    result._data = dbi::open(txn, name, flags).handle();
+    result._aggregates = dbi::open(txn, agg_name.c_str(), flags & MDB_CREATE).handle();
+    return result;
+  }
+
+  /**
+   * Returns the data database handle.
+   */
+  MDB_dbi handle() const noexcept {
+    return _data;
+  }
+
+  /**
+   * Registers a view grouped by a function of each record.
+   *
+   * @param name the view name, which must not contain a zero byte
+   * @param group returns the group of a record
+   * @param value returns the number a record contributes; if empty, only counts are kept
+   */
+  void add_view(const std::string_view name,
+                group_fn group,
+                value_fn value = {}) {
+    _views.push_back({std::string(name), std::move(group), std::move(value), 0});
+  }
+
+  /**
+   * Registers a view grouped by the first `n` bytes of each key. Unlike other
+   * views, its groups are rescanned from a range of keys, rather than the whole
+   * database, when a group's minimum or maximum is no longer reached.
+   */
+  void add_view(const std::string_view name,
+                const std::size_t n,
+                value_fn value = {}) {
+    _views.push_back({std::string(name), prefix(n), std::move(value), n});
+  }
+
+  /**
+   * Retrieves a value.
+   *
+   * @throws lmdb::error on failure
+   */
+  bool get(MDB_txn* const txn,
+           const std::string_view key,
+           std::string_view& val) const {
+    return dbi{_data}.get(txn, key, val);
+  }
+
+  /**
+   * Stores a key/value pair, updating every view.
+   *
+   * @param txn a write transaction handle
+   * @returns false if `MDB_NOOVERWRITE` was given and the key exists
+   * @throws lmdb::error on failure
+   */
+  bool put(MDB_txn* const txn,
+           const std::string_view key,
+           const std::string_view val,
+           const unsigned int flags = dbi::default_put_flags) {
+    std::string_view current;
+    std::optional<std::string> old;
+    if (dbi{_data}.get(txn, key, current)) {
+      if (flags & MDB_NOOVERWRITE) return false;
+      old.emplace(current);
+    }
+    dbi{_data}.put(txn, key, val, flags);
+    update(txn, key, old ? std::optional<std::string_view>(*old) : std::nullopt, val);
+    return true;
+  }
+
+  /**
+   * Removes a key, updating every view.
+   *
+   * @returns false if the key doesn't exist
+   * @throws lmdb::error on failure
+   */
+  bool del(MDB_txn* const txn,
+           const std::string_view key) {
+    std::string_view old;
+    if (!dbi{_data}.get(txn, key, old)) return false;
+    const std::string copy{old};
+    dbi{_data}.del(txn, key);
+    update(txn, key, std::string_view(copy), std::nullopt);
+    return true;
+  }
+
+  /**
+   * Returns the aggregate of one group of a view, with a single lookup. An
+   * empty group has a count of 0.
+   *
+   * @throws lmdb::error on failure
+   */
+  aggregate get(MDB_txn* const txn,
+                const std::string_view name,
+                const std::string_view group) const {
+    std::string_view val;
+    if (!dbi{_aggregates}.get(txn, aggregate_key(name, group), val)) return aggregate{};
+    return from_sv<record>(val).agg;
+  }
+
+  /**
+   * Calls `fn(group, aggregate)` for every group of a view, in group order.
+   *
+   * @throws lmdb::error on failure
+   */
+  void each(MDB_txn* const txn,
+            const std::string_view name,
+            const std::function<void(std::string_view group, const aggregate&)>& fn) const {
+    const std::string start = aggregate_key(name, {});
+    auto cursor = lmdb::cursor::open(txn, _aggregates);
+    std::string_view key{start}, val;
+    for (bool found = cursor.get(key, val, MDB_SET_RANGE); found; found = cursor.get(key, val, MDB_NEXT)) {
+      if (key.compare(0, start.size(), start) != 0) break;
+      fn(key.substr(start.size()), from_sv<record>(val).agg);
+    }
+  }
+
+  /**
+   * Recomputes a view from all the records, with one scan.
+   *
+   * @throws lmdb::error on failure, or `MDB_NOTFOUND` if the view isn't registered
+   */
+  void rebuild(MDB_txn* const txn,
+               const std::string_view name) {
+    const view& v = find(name);
+    const std::string start = aggregate_key(name, {});
+    dbi{_aggregates}.delete_prefix(txn, start);
+
+    std::map<std::string, record> groups;
+    auto cursor = lmdb::cursor::open(txn, _data);
+    std::string_view key, val;
+    for (bool found = cursor.get(key, val, MDB_FIRST); found; found = cursor.get(key, val, MDB_NEXT)) {
+      const auto g = v.group(key, val);
+      if (g) include(groups[*g], value_of(v, key, val));
+    }
+    for (const auto& g : groups) dbi{_aggregates}.put(txn, aggregate_key(name, g.first), to_sv(g.second));
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Commit Notification */
+
+#ifndef _WIN32
+
+namespace lmdb {
+  class notifier;
+}
+
+/**
+ * Cross-process commit notification channel for an environment.
+ *
+ * Writers publish the ID of each committed transaction into a small shared
+ * sidecar file next to the environment (`notify.mdb`, or `<path>-notify`
+ * when the environment was opened with `MDB_NOSUBDIR`). Readers block in
+ * `wait()` until a newer ID has been published, instead of polling
+ * `mdb_env_info()`. On Linux waiting is done with a futex on the shared
+ * mapping, so idle waiters use no CPU; elsewhere a short sleep loop is used.
+ *
+ * @note Only commits made through `commit()`, or announced with `notify()`,
+ *       wake up waiters.
+ * @note Instances of this class are movable, but not copyable.
+ */
+class lmdb::notifier {
+protected:
+  struct shared {
+    std::atomic<std::uint32_t> seq;
+    std::uint32_t pad;
+    std::atomic<std::uint64_t> txnid;
+  };
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "notifier requires lock-free 64-bit atomics");
+
+  shared* _shared{nullptr};
+
+public:
+  /**
+   * Opens (creating if necessary) the notification sidecar of an open environment.
+   *
+   * @param env the environment handle
+   * @throws lmdb::error on failure
+   */
+  static notifier open(MDB_env* const env) {
+    const char* path{nullptr};
+    unsigned int flags{};
+    lmdb::env_get_path(env, &path);
+    lmdb::env_get_flags(env, &flags);
+    const std::string file = std::string(path) + ((flags & MDB_NOSUBDIR) ? "-notify" : "/notify.mdb");
+
+    const int fd = ::open(file.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) error::raise("notifier::open", errno);
+    if (::ftruncate(fd, sizeof(shared)) != 0) {
+      const int rc = errno;
+      ::close(fd);
+      error::raise("notifier::open", rc);
+    }
+    void* const addr = ::mmap(nullptr, sizeof(shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int rc = errno;
+    ::close(fd);
+    if (addr == MAP_FAILED) error::raise("notifier::open", rc);
+
+    notifier result{static_cast<shared*>(addr)};
+    MDB_envinfo info;
+    lmdb::env_info(env, &info);
+    result.notify(info.me_last_txnid);
+    return result;
+  }
+
+  /**
+   * Move constructor.
+   */
+  notifier(notifier&& other) noexcept {
+    std::swap(_shared, other._shared);
+  }
+
+  /**
+   * Move assignment operator.
+   */
+  notifier& operator=(notifier&& other) noexcept {
+    if (this != &other) {
+      std::swap(_shared, other._shared);
+    }
+    return *this;
+  }
+
+  /**
+   * Destructor.
+   */
+  ~notifier() noexcept {
+    close();
+  }
+
+  /**
+   * Unmaps the sidecar.
+   *
+   * @note this method is idempotent
+   */
+  void close() noexcept {
+    if (_shared) {
+      ::munmap(_shared, sizeof(shared));
+      _shared = nullptr;
+    }
+  }
+
+  /**
+   * Returns the most recently published transaction ID.
+   */
+  std::size_t latest() const noexcept {
+    return _shared->txnid.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Publishes a committed transaction ID and wakes up all waiters.
+   * IDs lower than the currently published one are ignored.
+   *
+   * @param txnid
+   */
+  void notify(const std::size_t txnid) noexcept {
+    std::uint64_t cur = _shared->txnid.load(std::memory_order_relaxed);
+    while (cur < txnid && !_shared->txnid.compare_exchange_weak(cur, txnid, std::memory_order_release)) {}
+    _shared->seq.fetch_add(1, std::memory_order_release);
+#ifdef __linux__
+    ::syscall(SYS_futex, &_shared->seq, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+  }
+
+  /**
+   * Commits a write transaction and publishes the resulting transaction ID.
+   *
+   * @param txn a write transaction
+   * @throws lmdb::error on failure
+   */
+  void commit(lmdb::txn& txn) {
+    MDB_env* const env = txn.env();
+    txn.commit();
+    MDB_envinfo info;
+    lmdb::env_info(env, &info);
+    notify(info.me_last_txnid);
+  }
+
+  /**
+   * Blocks until a transaction ID greater than `after` is published, or the timeout expires.
+   *
+   * @param after the last transaction ID seen by the caller
+   * @param timeout
+   * @return the latest published transaction ID, which is `<= after` on timeout
+   */
+  std::size_t wait(const std::size_t after,
+                   const std::chrono::milliseconds timeout) const noexcept {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (;;) {
+      const std::uint32_t seq = _shared->seq.load(std::memory_order_acquire);
+      const std::size_t txnid = latest();
+      if (txnid > after) return txnid;
+      const auto now = std::chrono::steady_clock::now();
+      if (now >= deadline) return txnid;
+#ifdef __linux__
+      const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now).count();
+      struct timespec ts;
+      ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+      ts.tv_nsec = static_cast<long>(ns % 1000000000);
+      ::syscall(SYS_futex, &_shared->seq, FUTEX_WAIT, seq, &ts, nullptr, 0);
+#else
+      (void)seq;
+      std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(deadline - now, std::chrono::milliseconds(1)));
+#endif
+    }
+  }
+
+protected:
+  notifier(shared* const s) noexcept
+    : _shared{s} {}
+};
+
+#endif /* !_WIN32 */
+
 ////////////////////////////////////////////////////////////////////////////////
 
 #endif /* LMDBXX_H */
@@ -0,0 +1,66 @@
+/* This is free and unencumbered software released into the public domain. */
+
+/*
+ * Compares a database in two LMDB environments by their range digests, and
+ * prints the key ranges in which they differ.
+ *
+ * Usage: digest_diff <path-a> <path-b> [database] [threads]
+ */
+
+#include "lmdbxx/lmdb++.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+
+static std::string printable(std::string_view key) {
+  std::string result;
+  for (unsigned char c : key) {
+    if (c >= 0x20 && c < 0x7f && c != '\\') {
+      result += static_cast<char>(c);
+    } else {
+      char hex[5];
+      std::snprintf(hex, sizeof(hex), "\\x%02x", c);
+      result += hex;
+    }
+  }
+  return result;
+}
+
+static lmdb::digest_tree digest(const char* path, const char* name, const lmdb::digest_options& options) {
+  auto env = lmdb::env::create();
+  env.set_max_dbs(4096);
+  env.open(path, MDB_RDONLY);
+  auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+  return lmdb::digest_tree::compute(txn, lmdb::dbi::open(txn, name), options);
+}
+
+
+int main(int argc, char** argv) {
+  if (argc < 3 || argc > 5) {
+    std::cerr << "usage: " << argv[0] << " <path-a> <path-b> [database] [threads]" << std::endl;
+    return 2;
+  }
+
+  const char* const name = argc > 3 && *argv[3] ? argv[3] : nullptr;
+  lmdb::digest_options options;
+  options.threads = argc > 4 ? static_cast<unsigned int>(std::strtoul(argv[4], nullptr, 10)) : 1;
+
+  try {
+    const auto a = digest(argv[1], name, options);
+    const auto b = digest(argv[2], name, options);
+    const auto ranges = a.diff(b);
+
+    for (const auto& r : ranges) {
+      std::printf("[%s, %s)\n", printable(r.first).c_str(), r.second.empty() ? "end" : printable(r.second).c_str());
+    }
+    std::printf("%zu differing ranges; %llu entries in a, %llu in b\n", ranges.size(),
+                static_cast<unsigned long long>(a.root().count), static_cast<unsigned long long>(b.root().count));
+    return ranges.empty() ? 0 : 1;
+  } catch (const lmdb::error& e) {
+    std::cerr << e.what() << std::endl;
+    return 2;
+  }
+}
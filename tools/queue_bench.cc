@@ -0,0 +1,125 @@
+/* This is free and unencumbered software released into the public domain. */
+
+/*
+ * Measures the throughput of lmdb::queue against a queue kept with plain
+ * puts and deletes: string keys, and head and tail counters stored as records.
+ *
+ * Usage: queue_bench <path> [entries] [batch] [value-size]
+ */
+
+#include "lmdbxx/lmdb++.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+using bench_clock = std::chrono::steady_clock;
+
+static double rate(std::size_t n, bench_clock::time_point start) {
+  const std::chrono::duration<double> elapsed = bench_clock::now() - start;
+  return n / elapsed.count();
+}
+
+static std::size_t counter(MDB_txn* txn, lmdb::dbi& dbi, const char* name) {
+  std::string_view v;
+  return dbi.get(txn, name, v) ? lmdb::from_sv<std::size_t>(v) : 0;
+}
+
+/* The approach lmdb::queue replaces: counters bumped with a put for every entry. */
+static void naive(MDB_env* env, std::size_t entries, std::size_t batch, const std::string& value) {
+  lmdb::dbi dbi;
+  {
+    auto txn = lmdb::txn::begin(env);
+    dbi = lmdb::dbi::open(txn, "naive", MDB_CREATE);
+    txn.commit();
+  }
+
+  auto start = bench_clock::now();
+  for (std::size_t done = 0; done < entries;) {
+    auto txn = lmdb::txn::begin(env);
+    for (std::size_t i = 0; i < batch && done < entries; i++, done++) {
+      const std::size_t tail = counter(txn, dbi, "tail");
+      dbi.put(txn, "item:" + std::to_string(tail), value);
+      dbi.put(txn, "tail", lmdb::to_sv<std::size_t>(tail + 1));
+    }
+    txn.commit();
+  }
+  const double push = rate(entries, start);
+
+  start = bench_clock::now();
+  for (std::size_t done = 0; done < entries;) {
+    auto txn = lmdb::txn::begin(env);
+    for (std::size_t i = 0; i < batch && done < entries; i++, done++) {
+      const std::size_t head = counter(txn, dbi, "head");
+      std::string_view v;
+      const std::string key = "item:" + std::to_string(head);
+      if (!dbi.get(txn, key, v)) break;
+      dbi.del(txn, key);
+      dbi.put(txn, "head", lmdb::to_sv<std::size_t>(head + 1));
+    }
+    txn.commit();
+  }
+  std::printf("%-12s push %12.0f/s   pop %12.0f/s\n", "put/del", push, rate(entries, start));
+}
+
+static void queued(MDB_env* env, std::size_t entries, std::size_t batch, const std::string& value) {
+  lmdb::queue q;
+  {
+    auto txn = lmdb::txn::begin(env);
+    q = lmdb::queue::open(txn, "queue", MDB_CREATE);
+    txn.commit();
+  }
+
+  auto start = bench_clock::now();
+  std::vector<std::string_view> values;
+  for (std::size_t done = 0; done < entries; done += values.size()) {
+    values.assign(std::min(batch, entries - done), value);
+    auto txn = lmdb::txn::begin(env);
+    q.push(txn, values.begin(), values.end());
+    txn.commit();
+  }
+  const double push = rate(entries, start);
+
+  start = bench_clock::now();
+  for (std::size_t done = 0; done < entries;) {
+    auto txn = lmdb::txn::begin(env);
+    const std::size_t n = q.pop(txn, batch);
+    txn.commit();
+    if (!n) break;
+    done += n;
+  }
+  std::printf("%-12s push %12.0f/s   pop %12.0f/s\n", "lmdb::queue", push, rate(entries, start));
+}
+
+
+int main(int argc, char** argv) {
+  if (argc < 2 || argc > 5) {
+    std::cerr << "usage: " << argv[0] << " <path> [entries] [batch] [value-size]" << std::endl;
+    return 1;
+  }
+
+  const std::size_t entries = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000000;
+  const std::size_t batch = argc > 3 ? std::max<std::size_t>(std::strtoull(argv[3], nullptr, 10), 1) : 1000;
+  const std::string value(argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 64, 'x');
+
+  try {
+    std::filesystem::create_directories(argv[1]);
+    auto env = lmdb::env::create();
+    env.set_max_dbs(8);
+    env.set_mapsize(std::size_t(1) << 34);
+    env.open(argv[1], MDB_NOSYNC);
+
+    std::printf("%zu entries of %zu bytes, %zu per transaction\n", entries, value.size(), batch);
+    naive(env, entries, batch, value);
+    queued(env, entries, batch, value);
+  } catch (const lmdb::error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
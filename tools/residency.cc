@@ -0,0 +1,71 @@
+/* This is free and unencumbered software released into the public domain. */
+
+/*
+ * Reports how much of each database in an LMDB environment is resident in
+ * the page cache, along with the total resident working set.
+ *
+ * Usage: residency <path> [buckets]
+ */
+
+#include "lmdbxx/lmdb++.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+
+static double percent(std::size_t part, std::size_t whole) {
+  return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void report(const std::string& name, const lmdb::residency_stat& stat) {
+  std::printf("%-32s branch %8zu/%-8zu leaf %8zu/%-8zu overflow %8zu/%-8zu %10zu KiB\n",
+              name.c_str(),
+              stat.branch_resident, stat.branch_pages,
+              stat.leaf_resident, stat.leaf_pages,
+              stat.overflow_resident, stat.overflow_pages,
+              stat.resident_bytes() / 1024);
+
+  for (const auto& b : stat.histogram) {
+    std::string first;
+    for (unsigned char c : b.first_key.substr(0, 24)) first += (c >= 0x20 && c < 0x7f) ? static_cast<char>(c) : '.';
+    std::printf("    %-24s %8zu/%-8zu %5.1f%%\n", first.c_str(), b.resident, b.pages, percent(b.resident, b.pages));
+  }
+}
+
+
+int main(int argc, char** argv) {
+  if (argc < 2 || argc > 3) {
+    std::cerr << "usage: " << argv[0] << " <path> [buckets]" << std::endl;
+    return 1;
+  }
+
+  const unsigned int buckets = argc > 2 ? static_cast<unsigned int>(std::strtoul(argv[2], nullptr, 10)) : 16;
+
+  try {
+    auto env = lmdb::env::create();
+    env.set_max_dbs(4096);
+    env.open(argv[1], MDB_RDONLY);
+
+    auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+    std::size_t total = 0;
+
+    const auto main = lmdb::dbi::open(txn, nullptr).residency(txn, buckets);
+    report("(main)", main);
+    total += main.resident_bytes();
+
+    for (const auto& name : lmdb::dbi::names(txn)) {
+      const auto stat = lmdb::dbi::open(txn, name.c_str()).residency(txn, buckets);
+      report(name, stat);
+      total += stat.resident_bytes();
+    }
+
+    std::printf("\ntotal resident: %zu KiB\n", total / 1024);
+  } catch (const lmdb::error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}